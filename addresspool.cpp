@@ -0,0 +1,225 @@
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QHostInfo>
+#include <QTcpSocket>
+#include <QTimer>
+
+#include <algorithm>
+
+#include "addresspool.h"
+
+// RFC 8305: give IPv6 a head start before racing IPv4.
+const int HAPPY_EYEBALLS_DELAY_MS = 250;
+// Weight of the newest sample in the throughput average.
+const double THROUGHPUT_SMOOTHING = 0.3;
+
+AddressPool::~AddressPool()
+{
+    clear();
+}
+
+bool AddressPool::resolve(const QString &host, quint16 port, int timeoutMs)
+{
+    clear();
+    QEventLoop loop;
+    QHostInfo info;
+    QHostInfo::lookupHost(host, &loop, [&](const QHostInfo &result) {
+        info = result;
+        loop.quit();
+    });
+    loop.exec();
+    if (info.error() != QHostInfo::NoError || info.addresses().size() < 2) {
+        // Nothing to spread over, let Qt connect by name as before.
+        return false;
+    }
+
+    // Probe every address at once, IPv4 slightly delayed when there is an
+    // IPv6 candidate to prefer. Probe sockets cannot be handed over to
+    // QNetworkAccessManager, they only tell which addresses answer.
+    bool hasIPv6 = false;
+    for (const QHostAddress &address : info.addresses()) {
+        SERVER_ADDRESS server;
+        server.address = address;
+        server.isHealthy = false;
+        addresses.push_back(server);
+        hasIPv6 = hasIPv6 || address.protocol() == QAbstractSocket::IPv6Protocol;
+    }
+    probes.reset(new QObject);
+    probeClock.start();
+    probing = addresses.size();
+    probeDelay = hasIPv6 ? HAPPY_EYEBALLS_DELAY_MS : 0;
+    probeTimeout = timeoutMs;
+    graceStarted = false;
+    for (const SERVER_ADDRESS &server : addresses) {
+        const QHostAddress address = server.address;
+        QTcpSocket *socket = new QTcpSocket(probes.data());
+        QObject::connect(socket, &QTcpSocket::connected, socket, [this, socket, address]() {
+            socket->abort();
+            probeConnected(address);
+        });
+        QObject::connect(socket, &QAbstractSocket::errorOccurred, socket, [this, address]() {
+            probeFailed(address);
+        });
+        const int delay = address.protocol() != QAbstractSocket::IPv6Protocol ? probeDelay : 0;
+        QTimer::singleShot(delay, socket, [socket, address, port]() {
+            socket->connectToHost(address, port);
+        });
+    }
+    // Slow addresses may still join later, but not forever.
+    QTimer *deadline = new QTimer(probes.data());
+    deadline->setSingleShot(true);
+    QObject::connect(deadline, &QTimer::timeout, deadline, [this]() {
+        stopProbes();
+    });
+    deadline->start(timeoutMs);
+
+    // Wait for the first address and its grace period (see probeConnected).
+    waitingLoop = &loop;
+    QTimer::singleShot(timeoutMs, &loop, &QEventLoop::quit);
+    loop.exec();
+    waitingLoop = nullptr;
+    return !isEmpty();
+}
+
+void AddressPool::probeConnected(const QHostAddress &address)
+{
+    const int i = find(address.toString());
+    if (i < 0 || addresses[i].connectMs != -1)
+        return;
+    addresses[i].isHealthy = true;
+    addresses[i].connectMs = probeClock.elapsed();
+    qDebug() << "AddressPool: " << address.toString() << addresses[i].connectMs << "ms";
+    probing--;
+    if (!waitingLoop)
+        return;
+    if (probing == 0) {
+        waitingLoop->quit();
+        return;
+    }
+    if (!graceStarted) {
+        // A whole pool of segments is assigned as soon as resolve() returns.
+        // Addresses about as fast as this one answer within twice its
+        // connect time of their own (possibly delayed) start, wait for those.
+        graceStarted = true;
+        const qint64 deadline = qMin<qint64>(probeDelay + 2 * addresses[i].connectMs, probeTimeout);
+        QTimer::singleShot(int(qMax<qint64>(deadline - probeClock.elapsed(), 0)), waitingLoop, &QEventLoop::quit);
+    }
+}
+
+void AddressPool::probeFailed(const QHostAddress &address)
+{
+    const int i = find(address.toString());
+    if (i < 0 || addresses[i].connectMs != -1)
+        return;
+    addresses[i].connectMs = -2;
+    if (--probing == 0 && waitingLoop)
+        waitingLoop->quit();
+}
+
+void AddressPool::stopProbes()
+{
+    // Called from a probe's own timer, so the sockets go away later.
+    if (probes)
+        probes.take()->deleteLater();
+}
+
+void AddressPool::clear()
+{
+    // Drop the probes first, so none of them reports into the new list.
+    probes.reset();
+    addresses.clear();
+    probing = 0;
+}
+
+bool AddressPool::isEmpty() const
+{
+    for (const SERVER_ADDRESS &server : addresses) {
+        if (server.isHealthy)
+            return false;
+    }
+    return true;
+}
+
+QString AddressPool::acquire()
+{
+    int best = -1;
+    for (int i = 0; i < addresses.size(); i++) {
+        if (!addresses[i].isHealthy)
+            continue;
+        if (best < 0 || score(addresses[i]) / (addresses[i].active + 1)
+                        > score(addresses[best]) / (addresses[best].active + 1))
+            best = i;
+    }
+    if (best < 0)
+        return QString();
+    addresses[best].active++;
+    return addresses[best].address.toString();
+}
+
+QStringList AddressPool::ranked(const QString &first) const
+{
+    // The chosen address, then the healthy fallbacks from best to worst.
+    QVector<SERVER_ADDRESS> others;
+    for (const SERVER_ADDRESS &server : addresses) {
+        if (server.isHealthy && server.address.toString() != first)
+            others.push_back(server);
+    }
+    std::sort(others.begin(), others.end(), [this](const SERVER_ADDRESS &a, const SERVER_ADDRESS &b) {
+        return score(a) > score(b);
+    });
+    QStringList list;
+    if (!first.isEmpty())
+        list << first;
+    for (const SERVER_ADDRESS &server : others)
+        list << server.address.toString();
+    return list;
+}
+
+void AddressPool::release(const QString &address)
+{
+    const int i = find(address);
+    if (i >= 0 && addresses[i].active > 0)
+        addresses[i].active--;
+}
+
+void AddressPool::report(const QString &address, qint64 bytes, qint64 msecs)
+{
+    const int i = find(address);
+    if (i < 0 || msecs <= 0 || bytes <= 0)
+        return;
+    const double sample = double(bytes) / msecs;
+    SERVER_ADDRESS &server = addresses[i];
+    server.throughput = server.throughput > 0
+        ? server.throughput * (1 - THROUGHPUT_SMOOTHING) + sample * THROUGHPUT_SMOOTHING
+        : sample;
+}
+
+void AddressPool::fail(const QString &address)
+{
+    const int i = find(address);
+    if (i < 0)
+        return;
+    qDebug() << "AddressPool: dropping " << address;
+    addresses[i].isHealthy = false;
+}
+
+int AddressPool::find(const QString &address) const
+{
+    for (int i = 0; i < addresses.size(); i++) {
+        if (addresses[i].address.toString() == address)
+            return i;
+    }
+    return -1;
+}
+
+double AddressPool::score(const SERVER_ADDRESS &server) const
+{
+    // Unmeasured addresses borrow the best measured rate so they get tried.
+    if (server.throughput > 0)
+        return server.throughput;
+    double best = 0;
+    for (const SERVER_ADDRESS &other : addresses)
+        best = qMax(best, other.throughput);
+    return best > 0 ? best : 1;
+}
@@ -0,0 +1,59 @@
+#ifndef ADDRESSPOOL_H
+#define ADDRESSPOOL_H
+
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QScopedPointer>
+#include <QStringList>
+#include <QVector>
+
+class QEventLoop;
+class QObject;
+
+struct SERVER_ADDRESS {
+    QHostAddress address;
+    qint64 connectMs = -1;
+    double throughput = 0;
+    int active = 0;
+    bool isHealthy = true;
+};
+
+// Every address a host resolves to, probed happy-eyeballs style and scored
+// by the throughput its segments achieve. New segments go to the address
+// with the best score per running segment; failed addresses are dropped.
+// resolve() returns shortly after the first address connects, once the
+// ones about as fast have had a chance too; slower ones join the pool as
+// their probes succeed.
+class AddressPool
+{
+public:
+    ~AddressPool();
+
+    bool resolve(const QString &host, quint16 port, int timeoutMs = 2000);
+    void clear();
+    bool isEmpty() const;
+
+    QString acquire();
+    QStringList ranked(const QString &first) const;
+    void release(const QString &address);
+    void report(const QString &address, qint64 bytes, qint64 msecs);
+    void fail(const QString &address);
+
+private:
+    int find(const QString &address) const;
+    double score(const SERVER_ADDRESS &server) const;
+    void probeConnected(const QHostAddress &address);
+    void probeFailed(const QHostAddress &address);
+    void stopProbes();
+
+    QVector<SERVER_ADDRESS> addresses;
+    QScopedPointer<QObject> probes;
+    QEventLoop *waitingLoop = nullptr;
+    QElapsedTimer probeClock;
+    int probing = 0;
+    int probeDelay = 0;
+    int probeTimeout = 0;
+    bool graceStarted = false;
+};
+
+#endif // ADDRESSPOOL_H
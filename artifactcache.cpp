@@ -0,0 +1,245 @@
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "artifactcache.h"
+
+#if defined(Q_OS_LINUX)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+#if defined(Q_OS_UNIX)
+#include <unistd.h>
+#elif defined(Q_OS_WIN)
+#include <windows.h>
+#endif
+
+const QString CACHE_INDEX = "index.json";
+const QString CACHE_OBJECTS = "objects";
+
+ArtifactCache::ArtifactCache(const QString &directory, quint64 maxBytes)
+    : directory(directory), maxBytes(maxBytes)
+{
+    QDir().mkpath(QDir(directory).filePath(CACHE_OBJECTS));
+    load();
+}
+
+QString ArtifactCache::urlKey(const QUrl &url)
+{
+    // Credentials never go into the index, they do not change the resource.
+    return url.adjusted(QUrl::RemoveUserInfo | QUrl::RemoveFragment).toString();
+}
+
+CACHE_ENTRY ArtifactCache::lookup(const QUrl &url) const
+{
+    CACHE_ENTRY entry = entries.value(urlKey(url));
+    if (entry.isValid() && !QFile::exists(objectPath(entry.hash)))
+        return CACHE_ENTRY();
+    return entry;
+}
+
+QString ArtifactCache::objectPath(const QByteArray &hash) const
+{
+    return QDir(directory).filePath(CACHE_OBJECTS + '/' + QString::fromLatin1(hash));
+}
+
+bool ArtifactCache::insert(const QUrl &url, const QByteArray &eTag, const QByteArray &lastModified,
+                           const QString &fileName, const QByteArray &knownHash)
+{
+    if (eTag.isEmpty() && lastModified.isEmpty()) {
+        // Without a validator the entry could never be revalidated.
+        return false;
+    }
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    // Callers that already saw every byte pass the hash in to skip a re-read.
+    QByteArray hash = knownHash;
+    if (hash.isEmpty()) {
+        QCryptographicHash sha(QCryptographicHash::Sha256);
+        if (!sha.addData(&file))
+            return false;
+        hash = sha.result().toHex();
+    }
+    const quint64 size = file.size();
+    file.close();
+
+    if (!objects.contains(hash)) {
+        const QString target = objectPath(hash);
+        if (!QFile::exists(target) && !storeObject(fileName, target))
+            return false;
+        objects.insert(hash, CACHE_OBJECT());
+        objects[hash].size = size;
+        totalBytes += size;
+    }
+
+    CACHE_ENTRY entry;
+    entry.eTag = eTag;
+    entry.lastModified = lastModified;
+    entry.hash = hash;
+    entries.insert(urlKey(url), entry);
+    touch(hash);
+    evict();
+    save();
+    return true;
+}
+
+bool ArtifactCache::storeObject(const QString &fileName, const QString &target)
+{
+    // The object only appears under its final name once it is complete.
+    const QString partial = target + QStringLiteral(".part");
+    QFile::remove(partial);
+    if (!cloneFile(fileName, partial) && !QFile::copy(fileName, partial)) {
+        qDebug() << "ArtifactCache: unable to store" << fileName;
+        return false;
+    }
+    QFile::remove(target);
+    if (!QFile::rename(partial, target)) {
+        QFile::remove(partial);
+        return false;
+    }
+    return true;
+}
+
+bool ArtifactCache::materialize(const QByteArray &hash, const QString &fileName)
+{
+    const QString source = objectPath(hash);
+    if (!QFile::exists(source))
+        return false;
+    QFile::remove(fileName);
+    bool done = cloneFile(source, fileName);
+#if defined(Q_OS_UNIX)
+    if (!done && useHardLinks)
+        done = ::link(QFile::encodeName(source).constData(), QFile::encodeName(fileName).constData()) == 0;
+#elif defined(Q_OS_WIN)
+    if (!done && useHardLinks)
+        done = CreateHardLinkW(reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(fileName).utf16()),
+                               reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(source).utf16()), nullptr);
+#endif
+    if (!done)
+        done = QFile::copy(source, fileName);
+    if (done) {
+        touch(hash);
+        save();
+    }
+    return done;
+}
+
+void ArtifactCache::remove(const QUrl &url)
+{
+    if (entries.remove(urlKey(url)))
+        save();
+}
+
+void ArtifactCache::setMaxBytes(quint64 maxBytes)
+{
+    this->maxBytes = maxBytes;
+    evict();
+    save();
+}
+
+bool ArtifactCache::cloneFile(const QString &source, const QString &target)
+{
+#if defined(Q_OS_LINUX) && defined(FICLONE)
+    QFile in(source);
+    QFile out(target);
+    if (!in.open(QIODevice::ReadOnly) || !out.open(QIODevice::WriteOnly))
+        return false;
+    if (::ioctl(out.handle(), FICLONE, in.handle()) == 0)
+        return true;
+    out.close();
+    out.remove();
+    return false;
+#else
+    Q_UNUSED(source);
+    Q_UNUSED(target);
+    return false;
+#endif
+}
+
+void ArtifactCache::touch(const QByteArray &hash)
+{
+    if (objects.contains(hash))
+        objects[hash].lastUsed = QDateTime::currentDateTimeUtc();
+}
+
+void ArtifactCache::evict()
+{
+    while (totalBytes > maxBytes && !objects.isEmpty()) {
+        auto oldest = objects.begin();
+        for (auto it = objects.begin(); it != objects.end(); ++it) {
+            if (it.value().lastUsed < oldest.value().lastUsed)
+                oldest = it;
+        }
+        const QByteArray hash = oldest.key();
+        qDebug() << "ArtifactCache: evict" << hash;
+        QFile::remove(objectPath(hash));
+        totalBytes -= oldest.value().size;
+        objects.erase(oldest);
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (it.value().hash == hash)
+                it = entries.erase(it);
+            else
+                ++it;
+        }
+    }
+}
+
+void ArtifactCache::load()
+{
+    QFile index(QDir(directory).filePath(CACHE_INDEX));
+    if (!index.open(QIODevice::ReadOnly))
+        return;
+    const QJsonObject root = QJsonDocument::fromJson(index.readAll()).object();
+    const QJsonObject objectList = root.value(QStringLiteral("objects")).toObject();
+    for (auto it = objectList.begin(); it != objectList.end(); ++it) {
+        const QByteArray hash = it.key().toLatin1();
+        if (!QFile::exists(objectPath(hash)))
+            continue;
+        const QJsonObject value = it.value().toObject();
+        CACHE_OBJECT object;
+        object.size = value.value(QStringLiteral("size")).toVariant().toULongLong();
+        object.lastUsed = QDateTime::fromString(value.value(QStringLiteral("lastUsed")).toString(), Qt::ISODate);
+        objects.insert(hash, object);
+        totalBytes += object.size;
+    }
+    const QJsonObject entryList = root.value(QStringLiteral("urls")).toObject();
+    for (auto it = entryList.begin(); it != entryList.end(); ++it) {
+        const QJsonObject value = it.value().toObject();
+        CACHE_ENTRY entry;
+        entry.eTag = value.value(QStringLiteral("etag")).toString().toLatin1();
+        entry.lastModified = value.value(QStringLiteral("lastModified")).toString().toLatin1();
+        entry.hash = value.value(QStringLiteral("hash")).toString().toLatin1();
+        if (objects.contains(entry.hash))
+            entries.insert(it.key(), entry);
+    }
+}
+
+void ArtifactCache::save() const
+{
+    QJsonObject objectList;
+    for (auto it = objects.begin(); it != objects.end(); ++it) {
+        QJsonObject value;
+        value.insert(QStringLiteral("size"), QString::number(it.value().size));
+        value.insert(QStringLiteral("lastUsed"), it.value().lastUsed.toString(Qt::ISODate));
+        objectList.insert(QString::fromLatin1(it.key()), value);
+    }
+    QJsonObject entryList;
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        QJsonObject value;
+        value.insert(QStringLiteral("etag"), QString::fromLatin1(it.value().eTag));
+        value.insert(QStringLiteral("lastModified"), QString::fromLatin1(it.value().lastModified));
+        value.insert(QStringLiteral("hash"), QString::fromLatin1(it.value().hash));
+        entryList.insert(it.key(), value);
+    }
+    QJsonObject root;
+    root.insert(QStringLiteral("objects"), objectList);
+    root.insert(QStringLiteral("urls"), entryList);
+
+    QFile index(QDir(directory).filePath(CACHE_INDEX));
+    if (index.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        index.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+}
@@ -0,0 +1,65 @@
+#ifndef ARTIFACTCACHE_H
+#define ARTIFACTCACHE_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QHash>
+#include <QString>
+#include <QUrl>
+
+struct CACHE_ENTRY {
+    QByteArray eTag;
+    QByteArray lastModified;
+    QByteArray hash;
+    bool isValid() const {
+        return !hash.isEmpty();
+    }
+};
+
+struct CACHE_OBJECT {
+    quint64 size = 0;
+    QDateTime lastUsed;
+};
+
+// Local store of finished downloads. Bodies are kept once per SHA-256 under
+// objects/, and every URL points at the body it last returned together with
+// the validators needed for a conditional request.
+class ArtifactCache
+{
+public:
+    explicit ArtifactCache(const QString &directory, quint64 maxBytes = 4ULL * 1024 * 1024 * 1024);
+
+    CACHE_ENTRY lookup(const QUrl &url) const;
+    QString objectPath(const QByteArray &hash) const;
+    bool contains(const QByteArray &hash) const {
+        return objects.contains(hash);
+    }
+    // Only touches the files, so it can run on any thread. insert() skips
+    // the copy for an object that is already in place.
+    static bool storeObject(const QString &fileName, const QString &target);
+    bool insert(const QUrl &url, const QByteArray &eTag, const QByteArray &lastModified,
+                const QString &fileName, const QByteArray &knownHash = QByteArray());
+    bool materialize(const QByteArray &hash, const QString &fileName);
+    void remove(const QUrl &url);
+    void setMaxBytes(quint64 maxBytes);
+    void setUseHardLinks(bool useHardLinks) {
+        this->useHardLinks = useHardLinks;
+    }
+
+private:
+    static QString urlKey(const QUrl &url);
+    static bool cloneFile(const QString &source, const QString &target);
+    void touch(const QByteArray &hash);
+    void evict();
+    void load();
+    void save() const;
+
+    QString directory;
+    quint64 maxBytes;
+    quint64 totalBytes = 0;
+    bool useHardLinks = false;
+    QHash<QString, CACHE_ENTRY> entries;
+    QHash<QByteArray, CACHE_OBJECT> objects;
+};
+
+#endif // ARTIFACTCACHE_H
@@ -0,0 +1,151 @@
+#include <QDebug>
+#include <QFile>
+#include <QNetworkProxy>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+
+#include "batchdownloader.h"
+
+// Enough to keep every pooled connection (and an h2 session) busy while
+// bounding the number of open destination files.
+const int BATCH_MAX_IN_FLIGHT = 64;
+// Bounded so a paused reply stops reading its socket instead of buffering.
+const qint64 BATCH_READ_BUFFER_SIZE = 256 * 1024;
+
+BatchDownloader::BatchDownloader(const REQUEST_PARAM &rqParam, QObject *parent)
+    : QObject(parent), rqParam(rqParam)
+{
+    if (!rqParam.proxyName.isEmpty() && rqParam.proxyPort) {
+        QNetworkProxy proxy;
+        proxy.setType(QNetworkProxy::HttpProxy);
+        proxy.setHostName(rqParam.proxyName);
+        proxy.setPort(rqParam.proxyPort);
+        qnam.setProxy(proxy);
+    }
+}
+
+void BatchDownloader::start(const QList<BATCH_ITEM> &items)
+{
+    for (int i = 0; i < items.size(); i++)
+        pending.enqueue(qMakePair(i, items[i]));
+    total = items.size();
+    done = 0;
+    failed = 0;
+    isAborted = false;
+    isPaused = false;
+    while (running.size() < BATCH_MAX_IN_FLIGHT && !pending.isEmpty())
+        startNext();
+    checkFinished();
+}
+
+void BatchDownloader::abort()
+{
+    isAborted = true;
+    pending.clear();
+    // abort() emits finished synchronously, take the list first.
+    const QList<QNetworkReply *> replies = running.keys();
+    for (QNetworkReply *reply : replies)
+        reply->abort();
+}
+
+void BatchDownloader::pause()
+{
+    isPaused = true;
+}
+
+void BatchDownloader::resume()
+{
+    if (!isPaused)
+        return;
+    isPaused = false;
+    const QList<QNetworkReply *> replies = running.keys();
+    for (QNetworkReply *reply : replies)
+        drain(reply);
+    while (running.size() < BATCH_MAX_IN_FLIGHT && !pending.isEmpty())
+        startNext();
+    checkFinished();
+}
+
+void BatchDownloader::startNext()
+{
+    const QPair<int, BATCH_ITEM> next = pending.dequeue();
+    const BATCH_ITEM &item = next.second;
+    QFile *file = new QFile(item.fileName);
+    if (!file->open(QIODevice::WriteOnly)) {
+        qDebug() << "Batch: unable to open " << item.fileName << file->errorString();
+        delete file;
+        failed++;
+        done++;
+        emit item_finished(next.first, false);
+        return;
+    }
+
+    QNetworkRequest request(item.url);
+    request.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, QVariant(true));
+    request.setAttribute(QNetworkRequest::HttpPipeliningAllowedAttribute, QVariant(true));
+    QString concatenated = QStringLiteral("%1:%2").arg(rqParam.user, rqParam.password);
+    QByteArray data = concatenated.toLocal8Bit().toBase64();
+    QString headerData = "Basic " + data;
+    request.setRawHeader("Authorization", headerData.toLocal8Bit());
+    QNetworkReply *reply = qnam.get(request);
+    reply->setReadBufferSize(BATCH_READ_BUFFER_SIZE);
+    BATCH_REPLY runningReply;
+    runningReply.file = file;
+    runningReply.index = next.first;
+    running.insert(reply, runningReply);
+    connect(reply, &QNetworkReply::readyRead, this, &BatchDownloader::readyRead);
+    connect(reply, &QNetworkReply::finished, this, &BatchDownloader::replyFinished);
+}
+
+void BatchDownloader::readyRead()
+{
+    if (!isPaused)
+        drain(qobject_cast<QNetworkReply *>(sender()));
+}
+
+void BatchDownloader::drain(QNetworkReply *reply)
+{
+    auto it = running.find(reply);
+    if (it == running.end())
+        return;
+    const QByteArray data = reply->readAll();
+    it->file->write(data);
+    it->bytes += data.size();
+    emit item_progress(it->index, it->bytes, reply->header(QNetworkRequest::ContentLengthHeader).toLongLong());
+}
+
+void BatchDownloader::replyFinished()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
+    if (!running.contains(reply))
+        return;
+    const BATCH_REPLY finishedReply = running.take(reply);
+    QFile *file = finishedReply.file;
+    const bool ok = reply->error() == QNetworkReply::NoError;
+    if (ok) {
+        const QByteArray data = reply->readAll();
+        file->write(data);
+        file->close();
+    } else {
+        qDebug() << "Batch: " << reply->url().toString() << reply->errorString();
+        file->close();
+        file->remove();
+        failed++;
+    }
+    delete file;
+    reply->deleteLater();
+    done++;
+    emit item_finished(finishedReply.index, ok);
+
+    if (!isAborted && !isPaused) {
+        while (running.size() < BATCH_MAX_IN_FLIGHT && !pending.isEmpty())
+            startNext();
+    }
+    checkFinished();
+}
+
+void BatchDownloader::checkFinished()
+{
+    if (running.isEmpty() && pending.isEmpty())
+        emit finished(isAborted ? failed + total - done : failed);
+}
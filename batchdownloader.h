@@ -0,0 +1,71 @@
+#ifndef BATCHDOWNLOADER_H
+#define BATCHDOWNLOADER_H
+
+#include <QHash>
+#include <QNetworkAccessManager>
+#include <QObject>
+#include <QPair>
+#include <QQueue>
+#include <QUrl>
+
+#include "httpwindow.h"
+
+QT_BEGIN_NAMESPACE
+class QFile;
+class QNetworkReply;
+QT_END_NAMESPACE
+
+struct BATCH_ITEM {
+    QUrl url;
+    QString fileName;
+};
+
+struct BATCH_REPLY {
+    QFile *file = nullptr;
+    int index = 0;
+    qint64 bytes = 0;
+};
+
+// Fetches many small files without the per-file HEAD, threads and temp
+// files of a segmented download. Every GET goes through one shared
+// QNetworkAccessManager, so requests are multiplexed over HTTP/2 streams or
+// pipelined over its pooled keep-alive connections, and bodies are written
+// straight to their destination.
+class BatchDownloader : public QObject
+{
+    Q_OBJECT
+
+public:
+    BatchDownloader(const REQUEST_PARAM &rqParam, QObject *parent = nullptr);
+
+    void start(const QList<BATCH_ITEM> &items);
+    void abort();
+    void pause();
+    void resume();
+
+signals:
+    void item_progress(int index, qint64 bytes, qint64 total);
+    void item_finished(int index, bool ok);
+    void finished(int failed);
+
+private slots:
+    void readyRead();
+    void replyFinished();
+
+private:
+    void startNext();
+    void drain(QNetworkReply *reply);
+    void checkFinished();
+
+    QNetworkAccessManager qnam;
+    REQUEST_PARAM rqParam;
+    QQueue<QPair<int, BATCH_ITEM>> pending;
+    QHash<QNetworkReply *, BATCH_REPLY> running;
+    int total = 0;
+    int done = 0;
+    int failed = 0;
+    bool isAborted = false;
+    bool isPaused = false;
+};
+
+#endif // BATCHDOWNLOADER_H
@@ -1,8 +1,18 @@
 QT += network widgets
 
-HEADERS += httpwindow.h
+HEADERS += httpwindow.h \
+           addresspool.h \
+           artifactcache.h \
+           batchdownloader.h \
+           downloadlist.h \
+           zsyncdelta.h
 SOURCES += httpwindow.cpp \
-           main.cpp
+           addresspool.cpp \
+           artifactcache.cpp \
+           batchdownloader.cpp \
+           downloadlist.cpp \
+           main.cpp \
+           zsyncdelta.cpp
 FORMS += authenticationdialog.ui
 
 # install
@@ -0,0 +1,191 @@
+#include <QHeaderView>
+#include <QLocale>
+
+#include "downloadlist.h"
+
+// Four repaints a second is smooth enough for progress and speed.
+const int REFRESH_INTERVAL_MS = 250;
+
+DownloadListModel::DownloadListModel(QObject *parent)
+    : QAbstractTableModel(parent)
+{
+    clock.start();
+}
+
+int DownloadListModel::addDownload(const QUrl &url, const QString &fileName)
+{
+    return addDownloads(QList<QUrl>() << url, QStringList() << fileName);
+}
+
+int DownloadListModel::addDownloads(const QList<QUrl> &urls, const QStringList &fileNames)
+{
+    const int first = rows.size();
+    if (urls.isEmpty())
+        return first;
+    beginInsertRows(QModelIndex(), first, first + urls.size() - 1);
+    rows.reserve(first + urls.size());
+    for (int i = 0; i < urls.size(); i++) {
+        DOWNLOAD_ROW row;
+        row.url = urls[i];
+        row.fileName = fileNames.value(i);
+        row.sampledAt = clock.elapsed();
+        rows.push_back(row);
+    }
+    endInsertRows();
+    return first;
+}
+
+void DownloadListModel::setProgress(int row, quint64 bytes, quint64 total)
+{
+    if (row < 0 || row >= rows.size())
+        return;
+    DOWNLOAD_ROW &item = rows[row];
+    item.bytes = bytes;
+    item.total = total;
+    if (item.state == DOWNLOAD_QUEUED)
+        item.state = DOWNLOAD_RUNNING;
+    item.isDirty = true;
+}
+
+void DownloadListModel::setState(int row, DOWNLOAD_STATE state)
+{
+    if (row < 0 || row >= rows.size())
+        return;
+    rows[row].state = state;
+    rows[row].isDirty = true;
+}
+
+void DownloadListModel::setPaused(int row, bool paused)
+{
+    // Only rows that are actually transferring change, queued and finished
+    // entries of a paused batch keep their state.
+    const DOWNLOAD_STATE current = state(row);
+    if (paused && current == DOWNLOAD_RUNNING)
+        setState(row, DOWNLOAD_PAUSED);
+    else if (!paused && current == DOWNLOAD_PAUSED)
+        setState(row, DOWNLOAD_RUNNING);
+}
+
+DOWNLOAD_STATE DownloadListModel::state(int row) const
+{
+    return row >= 0 && row < rows.size() ? rows[row].state : DOWNLOAD_QUEUED;
+}
+
+void DownloadListModel::flush(int first, int last)
+{
+    // Rows outside the viewport stay dirty, the view reads them fresh anyway
+    // once they are scrolled in.
+    first = qMax(first, 0);
+    last = qMin(last, rows.size() - 1);
+    const qint64 now = clock.elapsed();
+    int top = -1;
+    int bottom = -1;
+    for (int i = first; i <= last; i++) {
+        DOWNLOAD_ROW &item = rows[i];
+        if (item.state == DOWNLOAD_RUNNING && now > item.sampledAt && item.bytes >= item.sampledBytes) {
+            item.speed = double(item.bytes - item.sampledBytes) * 1000 / (now - item.sampledAt);
+            item.isDirty = true;
+        }
+        item.sampledBytes = item.bytes;
+        item.sampledAt = now;
+        if (!item.isDirty)
+            continue;
+        item.isDirty = false;
+        if (top < 0)
+            top = i;
+        bottom = i;
+    }
+    if (top >= 0)
+        emit dataChanged(index(top, 0), index(bottom, ColumnCount - 1), QVector<int>() << Qt::DisplayRole);
+}
+
+int DownloadListModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : rows.size();
+}
+
+int DownloadListModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+QVariant DownloadListModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= rows.size())
+        return QVariant();
+    const DOWNLOAD_ROW &item = rows[index.row()];
+    if (role == Qt::ToolTipRole)
+        return item.url.toString();
+    if (role != Qt::DisplayRole)
+        return QVariant();
+
+    switch (index.column()) {
+    case FileColumn:
+        return item.fileName.isEmpty() ? item.url.fileName() : item.fileName;
+    case SizeColumn:
+        return item.total ? QLocale().formattedDataSize(item.total) : QString();
+    case ProgressColumn:
+        if (item.state == DOWNLOAD_FINISHED)
+            return QStringLiteral("100%");
+        return item.total ? QStringLiteral("%1%").arg(item.bytes * 100 / item.total) : QString();
+    case SpeedColumn:
+        if (item.state != DOWNLOAD_RUNNING)
+            return QString();
+        return tr("%1/s").arg(QLocale().formattedDataSize(qint64(item.speed)));
+    case StatusColumn:
+        switch (item.state) {
+        case DOWNLOAD_QUEUED: return tr("Queued");
+        case DOWNLOAD_RUNNING: return tr("Downloading");
+        case DOWNLOAD_PAUSED: return tr("Paused");
+        case DOWNLOAD_FINISHED: return tr("Finished");
+        case DOWNLOAD_FAILED: return tr("Failed");
+        case DOWNLOAD_CANCELED: return tr("Canceled");
+        }
+    }
+    return QVariant();
+}
+
+QVariant DownloadListModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+        return QVariant();
+    switch (section) {
+    case FileColumn: return tr("File");
+    case SizeColumn: return tr("Size");
+    case ProgressColumn: return tr("Progress");
+    case SpeedColumn: return tr("Speed");
+    case StatusColumn: return tr("Status");
+    }
+    return QVariant();
+}
+
+DownloadListView::DownloadListView(DownloadListModel *model, QWidget *parent)
+    : QTableView(parent), listModel(model)
+{
+    setModel(model);
+    setSelectionBehavior(QAbstractItemView::SelectRows);
+    setWordWrap(false);
+    setShowGrid(false);
+    // Fixed row heights let the view map scroll offsets to rows without
+    // measuring every row, which keeps huge lists cheap.
+    verticalHeader()->hide();
+    verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    verticalHeader()->setDefaultSectionSize(fontMetrics().height() + 6);
+    horizontalHeader()->setSectionResizeMode(DownloadListModel::FileColumn, QHeaderView::Stretch);
+
+    connect(&refreshTimer, &QTimer::timeout, this, &DownloadListView::refresh);
+    refreshTimer.start(REFRESH_INTERVAL_MS);
+}
+
+void DownloadListView::refresh()
+{
+    if (!isVisible() || !listModel->rowCount())
+        return;
+    int first = rowAt(0);
+    int last = rowAt(viewport()->height() - 1);
+    if (first < 0)
+        first = 0;
+    if (last < 0)
+        last = listModel->rowCount() - 1;
+    listModel->flush(first, last);
+}
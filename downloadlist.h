@@ -0,0 +1,78 @@
+#ifndef DOWNLOADLIST_H
+#define DOWNLOADLIST_H
+
+#include <QAbstractTableModel>
+#include <QElapsedTimer>
+#include <QTableView>
+#include <QTimer>
+#include <QUrl>
+#include <QVector>
+
+enum DOWNLOAD_STATE {
+    DOWNLOAD_QUEUED,
+    DOWNLOAD_RUNNING,
+    DOWNLOAD_PAUSED,
+    DOWNLOAD_FINISHED,
+    DOWNLOAD_FAILED,
+    DOWNLOAD_CANCELED
+};
+
+struct DOWNLOAD_ROW {
+    QUrl url;
+    QString fileName;
+    quint64 bytes = 0;
+    quint64 total = 0;
+    DOWNLOAD_STATE state = DOWNLOAD_QUEUED;
+    quint64 sampledBytes = 0;
+    qint64 sampledAt = 0;
+    double speed = 0;
+    bool isDirty = false;
+};
+
+// Progress setters only store the latest snapshot and mark the row dirty;
+// nothing is repainted until flush() reports the visible dirty rows in one
+// dataChanged, so the cost does not depend on how often workers report.
+class DownloadListModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    enum Column { FileColumn, SizeColumn, ProgressColumn, SpeedColumn, StatusColumn, ColumnCount };
+
+    explicit DownloadListModel(QObject *parent = nullptr);
+
+    int addDownload(const QUrl &url, const QString &fileName);
+    int addDownloads(const QList<QUrl> &urls, const QStringList &fileNames);
+    void setProgress(int row, quint64 bytes, quint64 total);
+    void setState(int row, DOWNLOAD_STATE state);
+    void setPaused(int row, bool paused);
+    DOWNLOAD_STATE state(int row) const;
+    void flush(int first, int last);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+private:
+    QVector<DOWNLOAD_ROW> rows;
+    QElapsedTimer clock;
+};
+
+// Table that repaints at a fixed rate instead of on every progress signal.
+class DownloadListView : public QTableView
+{
+    Q_OBJECT
+
+public:
+    explicit DownloadListView(DownloadListModel *model, QWidget *parent = nullptr);
+
+private slots:
+    void refresh();
+
+private:
+    DownloadListModel *listModel;
+    QTimer refreshTimer;
+};
+
+#endif // DOWNLOADLIST_H
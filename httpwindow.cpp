@@ -52,8 +52,12 @@
 #include <QtNetwork>
 #include <QUrl>
 #include <QHttp2Configuration>
+#include <QTemporaryDir>
+#include <cstdio>
 
 #include "httpwindow.h"
+#include "batchdownloader.h"
+#include "downloadlist.h"
 #include "ui_authenticationdialog.h"
 
 #if QT_CONFIG(ssl)
@@ -63,24 +67,31 @@ const char defaultUrl[] = "http://www.qt.io/";
 #endif
 const QString CONTENT_LENGTH = "Content-Length";
 const char defaultFileName[] = "index.html";
-
-ProgressDialog::ProgressDialog(const QUrl &url, QWidget *parent)
-    : QProgressDialog(parent)
-{
-    setWindowTitle(tr("Download Progress"));
-    setWindowFlags(windowFlags() & ~Qt::WindowContextHelpButtonHint);
-    setLabelText(tr("Downloading %1.").arg(url.toDisplayString()));
-    setMinimum(0);
-    setValue(0);
-    setMinimumDuration(0);
-    setMinimumSize(QSize(400, 75));
-}
-
-void ProgressDialog::networkReplyProgress(qint64 bytesRead, qint64 totalBytes)
-{
-    setMaximum(totalBytes);
-    setValue(bytesRead);
-}
+// Streaming splits the body into small ranges so the head of the file arrives
+// early; the window caps how far past the read cursor segments may run.
+const quint64 STREAM_SEGMENT_SIZE = 2 * 1024 * 1024;
+const quint64 STREAM_WINDOW_BYTES = 64 * 1024 * 1024;
+const int STREAM_MAX_WORKERS = 20;
+// Missing delta ranges are grouped into multi-range requests of this size.
+const int DELTA_RANGES_PER_REQUEST = 32;
+const quint64 DELTA_BATCH_BYTES = 16 * 1024 * 1024;
+const int DELTA_MAX_WORKERS = 8;
+// A bounded read buffer is what lets a paused reply push back on the server.
+const qint64 WORKER_READ_BUFFER_SIZE = 1024 * 1024;
+// How long a paused segment keeps its connection before closing it.
+const int WORKER_PAUSE_HOLD_MS = 30 * 1000;
+// Workers batch their progress into one report per interval.
+const qint64 WORKER_PROGRESS_INTERVAL_MS = 100;
+// How often a streamed range is asked for again before the stream fails.
+const int WORKER_MAX_RETRIES = 3;
+// Compressed transfer is only considered for text-like bodies of at least
+// this size; the sample measures single-stream speed and the zlib ratio.
+const quint64 COMPRESS_MIN_BYTES = 1024 * 1024;
+const qint64 COMPRESS_SAMPLE_BYTES = 256 * 1024;
+// Rough single-core inflate speed in bytes per millisecond.
+const double INFLATE_BYTES_PER_MS = 200.0 * 1024;
+// Speed-up assumed for a segmented download from a host with no history.
+const double SEGMENTED_SPEEDUP_GUESS = 4.0;
 
 DownloadWorker::DownloadWorker(const REQUEST_PARAM &rqParam, TEMP_FILE &tempFile)
     : QThread(), rqParam(rqParam), tempFile(tempFile)
@@ -101,12 +112,62 @@ void DownloadWorker::readyRead() {
         qDebug() << "Ready read but the requested is cancled";
         return;
     }
-    qint64 readByte = reply->bytesAvailable();
-    qDebug() << "ReadyRead - byteAvailable: " << readByte;
+    // While paused the data stays in the reply; its bounded read buffer
+    // fills up and Qt stops reading the socket, which throttles the sender.
+    if (this->isPaused || !reply) {
+        return;
+    }
+    if (rqParam.rangeSpec.isEmpty() && !rqParam.compressed && !rangeAccepted()) {
+        // An error page or the whole body in place of the range must never
+        // reach the segment file (a resume after a pause may get either),
+        // drop it and let replyFinished retry or fail the range.
+        reply->abort();
+        return;
+    }
+    const QByteArray data = reply->readAll();
     if (tempFile.file) {
-        tempFile.file->write(reply->readAll());
+        tempFile.file->write(data);
+        // The GUI thread drains streamed segments while they are still
+        // downloading, so the bytes have to reach the file right away.
+        if (rqParam.streaming)
+            tempFile.file->flush();
+    }
+    written += data.size();
+    reportProgress(data.size(), false);
+}
+
+void DownloadWorker::reportProgress(qint64 bytes, bool flush) {
+    // One queued event per interval instead of one per read keeps the GUI
+    // thread idle during heavy transfers.
+    unreported += bytes;
+    if (!unreported || (!flush && progressClock.isValid()
+                        && progressClock.elapsed() < WORKER_PROGRESS_INTERVAL_MS))
+        return;
+    progressClock.start();
+    emit reply_progress(unreported);
+    unreported = 0;
+}
+
+void DownloadWorker::fetchRange(quint64 start, quint64 end, QFile *file) {
+    if (this->isCancle) {
+        return;
+    }
+    if (!file) {
+        // Nothing left for this worker, leave the loop in run().
+        waitingLoop->quit();
+        return;
+    }
+    // Same thread, same manager: the next range goes over the connection
+    // the previous one left open.
+    rqParam.start = start;
+    rqParam.end = end;
+    tempFile = TEMP_FILE(file);
+    written = 0;
+    retries = 0;
+    clock.start();
+    if (!this->isPaused) {
+        startReply();
     }
-    emit reply_progress(readByte);
 }
 
 void DownloadWorker::doneRead() {
@@ -116,42 +177,228 @@ void DownloadWorker::doneRead() {
 }
 
 void DownloadWorker::cancle_download_slot() {
+    // The temp file belongs to HttpWindow, which removes it once this thread
+    // has stopped; touching it here raced with the GUI thread.
     this->isCancle = true;
-    this->reply->abort();
-    qDebug() << "DownloadWorker Cancle download: " << tempFile.file->fileName();
-    if (tempFile.file) {
-        tempFile.file->close();
-        tempFile.file->remove();
-        delete tempFile.file;
-        tempFile.file = nullptr;
+    qDebug() << "DownloadWorker Cancle download: " << rqParam.start << "-" << rqParam.end;
+    if (this->reply) {
+        this->reply->abort();
+    }
+    if (this->waitingLoop) {
+        this->waitingLoop->quit();
     }
     emit cancle_download_signal();
 }
 
-void DownloadWorker::run() {
+void DownloadWorker::pause_download_slot() {
+    if (this->isCancle || this->isPaused) {
+        return;
+    }
+    this->isPaused = true;
+    pauseTimer->start(WORKER_PAUSE_HOLD_MS);
+}
+
+void DownloadWorker::resume_download_slot() {
+    if (this->isCancle || !this->isPaused) {
+        return;
+    }
+    this->isPaused = false;
+    pauseTimer->stop();
+    if (this->reply) {
+        // Still connected, pick up what was buffered while paused.
+        readyRead();
+    } else if (tempFile.file) {
+        startReply();
+    }
+}
+
+void DownloadWorker::pauseTimeout() {
+    // Don't hold an idle connection forever, drop it but keep every byte
+    // written so far; resume asks for the rest of the range.
+    if (this->isPaused && this->reply) {
+        qDebug() << "DownloadWorker pause timeout, closing connection at " << rqParam.start + written;
+        this->reply->abort();
+    }
+}
+
+void DownloadWorker::startReply() {
     QNetworkRequest request(rqParam.url);
     request.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, QVariant(true));
     request.setAttribute(QNetworkRequest::HTTP2WasUsedAttribute, QVariant(true));
+    if (addressIndex < rqParam.addresses.size()) {
+        // Connect to one resolved address but keep Host, SNI and the
+        // certificate check on the real name. HTTP/2 derives :authority
+        // from the URL, so these go over HTTP/1.1.
+        QUrl target = rqParam.url;
+        target.setHost(rqParam.addresses[addressIndex]);
+        request.setUrl(target);
+        QString host = rqParam.url.host();
+        if (rqParam.url.port() != -1)
+            host += QStringLiteral(":%1").arg(rqParam.url.port());
+        request.setRawHeader("Host", host.toLatin1());
+        request.setPeerVerifyName(rqParam.url.host());
+        request.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, QVariant(false));
+    }
     QString concatenated = QStringLiteral("%1:%2").arg(rqParam.user, rqParam.password);
     QByteArray data = concatenated.toLocal8Bit().toBase64();
     QString headerData = "Basic " + data;
     request.setRawHeader("Authorization", headerData.toLocal8Bit());
-    QString rangeHeader = QStringLiteral("bytes=%1-%2").arg(rqParam.start).arg(rqParam.end);
-    request.setRawHeader("Range", rangeHeader.toLocal8Bit());
+    if ((!rqParam.rangeSpec.isEmpty() || rqParam.compressed) && written) {
+        // Neither a multi-range nor a compressed body can be continued in
+        // the middle, start over.
+        reportProgress(-qint64(written), true);
+        tempFile.file->resize(0);
+        tempFile.file->seek(0);
+        written = 0;
+    }
+    // A compressed transfer is one plain GET; Qt asks for gzip/deflate and
+    // inflates on its network thread, this thread only writes the result.
+    // Ranges must address the identity body, or offsets and resume points
+    // would count bytes of a different representation.
+    if (!rqParam.compressed) {
+        request.setRawHeader("Accept-Encoding", "identity");
+        QString rangeHeader = rqParam.rangeSpec.isEmpty()
+            ? QStringLiteral("bytes=%1-%2").arg(rqParam.start + written).arg(rqParam.end)
+            : rqParam.rangeSpec;
+        request.setRawHeader("Range", rangeHeader.toLocal8Bit());
+    }
     QHttp2Configuration http2Config = request.http2Configuration();
     http2Config.setMaxFrameSize(65536);
     request.setHttp2Configuration(http2Config);
     this->reply = qnam.get(request);
-    QEventLoop waitingLoop;
-    QObject::connect(reply, &QNetworkReply::finished, &waitingLoop, &QEventLoop::quit);
-    //QObject::connect(this, &DownloadWorker::cancle_download_signal, &waitingLoop, &QEventLoop::quit);
+    this->reply->setReadBufferSize(WORKER_READ_BUFFER_SIZE);
     //QObject::connect(reply, &QNetworkReply::downloadProgress, this, &DownloadWorker::reply_progress);
 
+    QObject::connect(reply, &QNetworkReply::finished, this, &DownloadWorker::replyFinished);
     QObject::connect(reply, &QNetworkReply::readyRead, this, &DownloadWorker::readyRead);
-    waitingLoop.exec();
-    if (!this->isCancle) {
+}
+
+bool DownloadWorker::rangeAccepted() const {
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status == 206)
+        return true;
+    // A server may answer a range covering the whole body with a plain 200.
+    return status == 200 && rqParam.start + written == 0
+        && reply->header(QNetworkRequest::ContentLengthHeader).toULongLong() == rqParam.end + 1;
+}
+
+bool DownloadWorker::replyOk() const {
+    if (!reply || reply->error() != QNetworkReply::NoError)
+        return false;
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status < 200 || status >= 300)
+        return false;
+    // Multi-range and compressed bodies are checked by whoever consumes them.
+    if (rqParam.rangeSpec.isEmpty() && !rqParam.compressed)
+        return written == rqParam.end - rqParam.start + 1;
+    return true;
+}
+
+bool DownloadWorker::rangeIgnored() const {
+    // A 200 for a range means the server does not do ranges (any more),
+    // asking again would only fetch the whole body again.
+    return rqParam.rangeSpec.isEmpty() && !rqParam.compressed
+        && reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 200 && !replyOk();
+}
+
+bool DownloadWorker::retryRange() {
+    if (replyOk() || rangeIgnored() || retries >= WORKER_MAX_RETRIES)
+        return false;
+    // Everything written so far is part of the range, ask for the rest.
+    retries++;
+    qDebug() << "DownloadWorker retrying range at " << rqParam.start + written;
+    reply->deleteLater();
+    reply = nullptr;
+    if (!this->isPaused) {
+        startReply();
+    }
+    return true;
+}
+
+void DownloadWorker::finishRange() {
+    if (retryRange())
+        return;
+    const bool ok = replyOk();
+    const bool ignored = rangeIgnored();
+    reply->deleteLater();
+    reply = nullptr;
+    emit address_stats(QString(), rqParam.addresses.value(addressIndex), qint64(written), clock.elapsed());
+    const QString fileName = tempFile.file->fileName();
+    // The file belongs to HttpWindow, the next range brings its own.
+    tempFile = TEMP_FILE();
+    if (ignored)
+        emit range_ignored(fileName);
+    emit download_done(fileName, ok);
+}
+
+void DownloadWorker::replyFinished() {
+    if (this->isCancle) {
+        return;
+    }
+    if (this->isPaused && reply->error() == QNetworkReply::OperationCanceledError) {
+        // Closed by pauseTimeout, wait in the loop for resume.
+        reportProgress(0, true);
+        reply->deleteLater();
+        reply = nullptr;
+        return;
+    }
+    // Whatever is left in the buffer belongs to this range, even when paused.
+    const bool paused = this->isPaused;
+    this->isPaused = false;
+    readyRead();
+    this->isPaused = paused;
+    reportProgress(0, true);
+
+    const QNetworkReply::NetworkError error = reply->error();
+    const bool connectionError = error != QNetworkReply::NoError
+        && error != QNetworkReply::OperationCanceledError
+        && error <= QNetworkReply::UnknownNetworkError;
+    if (connectionError && addressIndex < rqParam.addresses.size()) {
+        // Move on to the next address (the host name after the last one)
+        // and carry on from the current offset.
+        qDebug() << "DownloadWorker address failed: " << rqParam.addresses[addressIndex] << reply->errorString();
+        emit address_failed(rqParam.addresses[addressIndex]);
+        addressIndex++;
+        reply->deleteLater();
+        reply = nullptr;
+        if (!this->isPaused) {
+            startReply();
+        }
+        return;
+    }
+    if (rqParam.streaming) {
+        // Stay in the loop, HttpWindow hands out the next range.
+        finishRange();
+        return;
+    }
+    if (rqParam.rangeSpec.isEmpty() && !rqParam.compressed && retryRange())
+        return;
+    waitingLoop->quit();
+}
+
+void DownloadWorker::run() {
+    QEventLoop loop;
+    QTimer timer;
+    timer.setSingleShot(true);
+    QObject::connect(&timer, &QTimer::timeout, this, &DownloadWorker::pauseTimeout);
+    this->waitingLoop = &loop;
+    this->pauseTimer = &timer;
+    //QObject::connect(this, &DownloadWorker::cancle_download_signal, &waitingLoop, &QEventLoop::quit);
+    clock.start();
+    startReply();
+    loop.exec();
+    this->waitingLoop = nullptr;
+    this->pauseTimer = nullptr;
+    if (!this->isCancle && rqParam.streaming) {
+        // Every range has been reported, only give the address back.
+        emit address_stats(rqParam.addresses.value(0), QString(), 0, 0);
+    } else if (!this->isCancle) {
         qDebug() << "Download done: " << tempFile.file->fileName();
-        emit download_done(tempFile.file->fileName());
+        emit address_stats(rqParam.addresses.value(0), rqParam.addresses.value(addressIndex),
+            qint64(written), clock.elapsed());
+        emit download_header(tempFile.file->fileName(), reply->rawHeader("Content-Type"),
+            reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt());
+        emit download_done(tempFile.file->fileName(), replyOk());
     }
 }
 
@@ -160,7 +407,15 @@ HttpWindow::HttpWindow(QWidget *parent)
     , statusLabel(new QLabel(tr("Please enter the URL of a file you want to download.\n\n"), this))
     , urlLineEdit(new QLineEdit(defaultUrl))
     , downloadButton(new QPushButton(tr("Download")))
+    , batchButton(new QPushButton(tr("Batch...")))
+    , cancelButton(new QPushButton(tr("Cancel")))
+    , pauseButton(new QPushButton(tr("Pause")))
+    , downloadModel(new DownloadListModel(this))
+    , downloadView(new DownloadListView(downloadModel))
     , launchCheckBox(new QCheckBox("Launch file"))
+    , streamCheckBox(new QCheckBox("Stream to standard output"))
+    , cacheCheckBox(new QCheckBox("Use local cache"))
+    , deltaCheckBox(new QCheckBox("Delta update existing file (zsync)"))
     , defaultFileLineEdit(new QLineEdit(defaultFileName))
     , downloadDirectoryLineEdit(new QLineEdit)
     , userNameEdit(new QLineEdit)
@@ -171,6 +426,8 @@ HttpWindow::HttpWindow(QWidget *parent)
     , reply(nullptr)
     , file(nullptr)
     , httpRequestAborted(false)
+    , streamWindowBytes(STREAM_WINDOW_BYTES)
+    , contentHash(QCryptographicHash::Sha256)
 {
     setWindowFlags(windowFlags() & ~Qt::WindowContextHelpButtonHint);
     setWindowTitle(tr("Buffalo-Downloader"));
@@ -200,22 +457,42 @@ HttpWindow::HttpWindow(QWidget *parent)
     formLayout->addRow(tr("Proxy port"), proxyPortEdit);
     launchCheckBox->setChecked(false);
     formLayout->addRow(launchCheckBox);
+    streamCheckBox->setChecked(false);
+    formLayout->addRow(streamCheckBox);
+    cacheCheckBox->setChecked(false);
+    formLayout->addRow(cacheCheckBox);
+    deltaCheckBox->setChecked(false);
+    formLayout->addRow(deltaCheckBox);
 
     QVBoxLayout *mainLayout = new QVBoxLayout(this);
     mainLayout->addLayout(formLayout);
 
-    mainLayout->addItem(new QSpacerItem(0, 0, QSizePolicy::Ignored, QSizePolicy::MinimumExpanding));
+    mainLayout->addWidget(downloadView, 1);
 
     statusLabel->setWordWrap(true);
     mainLayout->addWidget(statusLabel);
 
     downloadButton->setDefault(true);
     connect(downloadButton, &QAbstractButton::clicked, this, &HttpWindow::downloadFile);
+    batchButton->setAutoDefault(false);
+    connect(batchButton, &QAbstractButton::clicked, this, &HttpWindow::downloadBatch);
+    cancelButton->setAutoDefault(false);
+    cancelButton->setEnabled(false);
+    connect(cancelButton, &QAbstractButton::clicked, this, &HttpWindow::cancelDownload);
+    pauseButton->setAutoDefault(false);
+    pauseButton->setEnabled(false);
+    connect(pauseButton, &QAbstractButton::clicked, this, &HttpWindow::togglePause);
+    downloadView->setContextMenuPolicy(Qt::CustomContextMenu);
+    connect(downloadView, &QWidget::customContextMenuRequested, this, &HttpWindow::showDownloadMenu);
+    connect(this, &HttpWindow::download_done_signal, this, &HttpWindow::downloadDone);
     QPushButton *quitButton = new QPushButton(tr("Quit"));
     quitButton->setAutoDefault(false);
     connect(quitButton, &QAbstractButton::clicked, this, &QWidget::close);
     QDialogButtonBox *buttonBox = new QDialogButtonBox;
     buttonBox->addButton(downloadButton, QDialogButtonBox::ActionRole);
+    buttonBox->addButton(batchButton, QDialogButtonBox::ActionRole);
+    buttonBox->addButton(pauseButton, QDialogButtonBox::ActionRole);
+    buttonBox->addButton(cancelButton, QDialogButtonBox::ActionRole);
     buttonBox->addButton(quitButton, QDialogButtonBox::RejectRole);
     mainLayout->addWidget(buttonBox);
 
@@ -240,6 +517,41 @@ HttpWindow::HttpWindow(QWidget *parent)
 
 }
 
+HttpWindow::~HttpWindow()
+{
+    delete cache;
+}
+
+void HttpWindow::setCacheOptions(quint64 maxBytes, bool useHardLinks)
+{
+    cacheMaxBytes = maxBytes;
+    cacheHardLinks = useHardLinks;
+    if (cache) {
+        cache->setMaxBytes(maxBytes);
+        cache->setUseHardLinks(useHardLinks);
+    }
+}
+
+ArtifactCache *HttpWindow::artifactCache()
+{
+    // Created on first use, so a session without the cache never touches
+    // the cache directory.
+    if (!cache) {
+        cache = new ArtifactCache(QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("artifacts"),
+            cacheMaxBytes);
+        cache->setUseHardLinks(cacheHardLinks);
+    }
+    return cache;
+}
+
+void HttpWindow::failDownload(const QString &message)
+{
+    // Tears the job down like Cancel does, but leaves the row failed.
+    cancelDownload();
+    downloadModel->setState(currentRow, DOWNLOAD_FAILED);
+    statusLabel->setText(tr("Download failed:\n%1").arg(message));
+}
+
 quint64 HttpWindow::getContentLength(const QUrl &requestedUrl)
 {
     url = requestedUrl;
@@ -255,17 +567,39 @@ quint64 HttpWindow::getContentLength(const QUrl &requestedUrl)
     QHttp2Configuration http2Config = request.http2Configuration();
     http2Config.setMaxFrameSize(65536);
     request.setHttp2Configuration(http2Config);
+    // A cached copy turns the probe into a conditional request, so an
+    // unchanged artifact costs one round trip and no body.
+    cacheEntry = CACHE_ENTRY();
+    if (cacheCheckBox->isChecked())
+        cacheEntry = artifactCache()->lookup(url);
+    if (cacheEntry.isValid()) {
+        if (!cacheEntry.eTag.isEmpty())
+            request.setRawHeader("If-None-Match", cacheEntry.eTag);
+        if (!cacheEntry.lastModified.isEmpty())
+            request.setRawHeader("If-Modified-Since", cacheEntry.lastModified);
+    }
+    // Ranges address the identity body, so ask for its length explicitly.
+    request.setRawHeader("Accept-Encoding", "identity");
     reply = qnam->head(request);
     QEventLoop eventLoop;
     QObject::connect(reply, SIGNAL(finished()), &eventLoop, SLOT(quit()));
     eventLoop.exec();
 
+    probeContentType = reply->rawHeader("Content-Type");
+    probeETag = reply->rawHeader("ETag");
+    probeLastModified = reply->rawHeader("Last-Modified");
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    cacheHit = cacheEntry.isValid()
+        && (status == 304 || (!probeETag.isEmpty() && probeETag == cacheEntry.eTag));
+
     QList<QByteArray> reply_headers = reply->rawHeaderList();
     quint64 len = 0;
+    lengthKnown = false;
     foreach(QByteArray head, reply_headers) {
         QString headStr = QString::fromUtf8(head);
         if (headStr.contains(CONTENT_LENGTH, Qt::CaseInsensitive)) {
             len = reply->rawHeader(head).toULong();
+            lengthKnown = reply->error() == QNetworkReply::NoError;
         }
         qDebug() << head << ":" << reply->rawHeader(head);
     }
@@ -274,7 +608,7 @@ quint64 HttpWindow::getContentLength(const QUrl &requestedUrl)
 
 DownloadWorker*  HttpWindow::pickWorker() {
     for (auto worker: downloadWorkerPools) {
-        if (worker->isIdle()) {
+        if (worker && worker->isIdle()) {
             return worker;
         }
     }
@@ -282,14 +616,139 @@ DownloadWorker*  HttpWindow::pickWorker() {
     return nullptr;
 }
 
+void HttpWindow::startWorker(DownloadWorker *worker)
+{
+    connect(this, &HttpWindow::stop_workers_signal, worker, &DownloadWorker::cancle_download_slot);
+    connect(this, &HttpWindow::pause_signal, worker, &DownloadWorker::pause_download_slot);
+    connect(this, &HttpWindow::resume_signal, worker, &DownloadWorker::resume_download_slot);
+    connect(worker, &DownloadWorker::reply_progress, this, &HttpWindow::download_progress);
+    connect(worker, &DownloadWorker::address_stats, this, &HttpWindow::addressStats);
+    connect(worker, &DownloadWorker::address_failed, this, &HttpWindow::addressFailed);
+    connect(worker, &QThread::finished, worker, &QThread::deleteLater, Qt::QueuedConnection);
+    downloadWorkerPools.removeAll(QPointer<DownloadWorker>());
+    downloadWorkerPools.push_back(worker);
+    worker->start();
+}
+
+void HttpWindow::assignAddress(REQUEST_PARAM &rqParam)
+{
+    if (addressPool.isEmpty())
+        return;
+    rqParam.addresses = addressPool.ranked(addressPool.acquire());
+}
+
+void HttpWindow::addressStats(const QString &assigned, const QString &used, qint64 bytes, qint64 msecs)
+{
+    addressPool.release(assigned);
+    addressPool.report(used, bytes, msecs);
+}
+
+void HttpWindow::addressFailed(const QString &address)
+{
+    addressPool.fail(address);
+}
+
+void HttpWindow::stopWorkers()
+{
+    // Every worker aborts its reply in its own thread; wait for all of them
+    // so nothing still writes into a temp file we are about to remove.
+    emit stop_workers_signal();
+    for (auto worker : downloadWorkerPools) {
+        if (worker)
+            worker->wait();
+    }
+    downloadWorkerPools.clear();
+}
+
+void HttpWindow::setJobPaused(bool paused)
+{
+    if (jobPaused == paused)
+        return;
+    jobPaused = paused;
+    downloadModel->setPaused(currentRow, paused);
+    if (paused) {
+        emit pause_signal();
+    } else {
+        emit resume_signal();
+        scheduleStreamSegments();
+        if (deltaOut)
+            scheduleDeltaBatches();
+    }
+    updatePauseButton();
+}
+
+void HttpWindow::setBatchPaused(bool paused)
+{
+    if (!batch || batchPaused == paused)
+        return;
+    batchPaused = paused;
+    if (paused)
+        batch->pause();
+    else
+        batch->resume();
+    for (int row = batchFirstRow; row < downloadModel->rowCount(); row++)
+        downloadModel->setPaused(row, paused);
+    updatePauseButton();
+}
+
+void HttpWindow::updatePauseButton()
+{
+    pauseButton->setEnabled(cancelButton->isEnabled());
+    pauseButton->setText(jobPaused || batchPaused ? tr("Resume") : tr("Pause"));
+    if (jobPaused || batchPaused)
+        statusLabel->setText(tr("Paused, downloaded data is kept."));
+}
+
+void HttpWindow::togglePause()
+{
+    // Global: pause everything that runs, or resume everything that is paused.
+    const bool paused = !(jobPaused || batchPaused);
+    setJobPaused(paused);
+    setBatchPaused(paused);
+    if (!paused)
+        statusLabel->setText(tr("Downloading %1...").arg(url.toString()));
+}
+
+void HttpWindow::showDownloadMenu(const QPoint &pos)
+{
+    // Either the segmented job or the batch is active, a row maps to it.
+    const int row = downloadView->rowAt(pos.y());
+    const bool isBatch = batch && row >= batchFirstRow;
+    const bool isCurrent = !isBatch && row >= 0 && row == currentRow
+        && (downloadModel->state(row) == DOWNLOAD_RUNNING || downloadModel->state(row) == DOWNLOAD_PAUSED);
+    if (!isCurrent && !isBatch)
+        return;
+    const bool paused = isBatch ? batchPaused : jobPaused;
+    QMenu menu(this);
+    QAction *pauseAction = menu.addAction(paused ? tr("Resume") : tr("Pause"));
+    QAction *cancelAction = menu.addAction(tr("Cancel"));
+    QAction *chosen = menu.exec(downloadView->viewport()->mapToGlobal(pos));
+    if (chosen == pauseAction) {
+        if (isBatch)
+            setBatchPaused(!paused);
+        else
+            setJobPaused(!paused);
+    } else if (chosen == cancelAction) {
+        cancelDownload();
+    }
+}
+
 void HttpWindow::startRequest(const QUrl &requestedUrl)
 {
     totalBytes = getContentLength(requestedUrl);
     currentBytes = 0;
     url = requestedUrl;
     httpRequestAborted = false;
-    QString user = userNameEdit->text();
-    QString password = passEdit->text();
+    contentHash.reset();
+    segmentsOk = true;
+    if (cacheHit) {
+        if (finishFromCache())
+            return;
+        // The cached body is unusable, drop it and probe again without validators.
+        artifactCache()->remove(requestedUrl);
+        totalBytes = getContentLength(requestedUrl);
+        contentHash.reset();
+    }
     //QNetworkRequest request(url);
     //request.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, QVariant(true));
     //request.setAttribute(QNetworkRequest::HTTP2WasUsedAttribute, QVariant(true));
@@ -303,45 +762,753 @@ void HttpWindow::startRequest(const QUrl &requestedUrl)
     //connect(reply, &QNetworkReply::finished, this, &HttpWindow::httpFinished);
     //connect(reply, &QIODevice::readyRead, this, &HttpWindow::httpReadyRead);
 
-    ProgressDialog *progressDialog = new ProgressDialog(url, this);
-    progressDialog->setAttribute(Qt::WA_DeleteOnClose);
-    connect(progressDialog, &QProgressDialog::canceled, this, &HttpWindow::cancelDownload);
-    connect(this, &HttpWindow::download_progress_signal, progressDialog, &ProgressDialog::networkReplyProgress);
-    connect(this, &HttpWindow::download_done_signal, progressDialog, &ProgressDialog::hide);
-    connect(this, &HttpWindow::cancle_signal, progressDialog, &ProgressDialog::close);
-    //connect(this, &HttpWindow::cancle_signal, progressDialog, &ProgressDialog::hide);
-    progressDialog->show();
+    // Resolving and the compression probes spin nested event loops; do them
+    // before the row exists and Cancel/Pause are enabled, so neither can act
+    // on a job whose workers are not running yet.
+    REQUEST_PARAM rqParam = requestParam(requestedUrl);
+    resolveAddresses(rqParam);
+    const bool streaming = streamDevice || streamCallback;
+    QByteArray head;
+    compressedTransfer = false;
+    downloadClock.start();
+    if (!streaming && lengthKnown)
+        compressedTransfer = shouldCompress(requestedUrl, &head);
+
+    addDownloadRow(file ? file->fileName() : url.fileName());
 
     statusLabel->setText(tr("Downloading %1...").arg(url.toString()));
 
-    //Testing
-    REQUEST_PARAM rqParam;
-    rqParam.url = requestedUrl;
-    rqParam.user = user;
-    rqParam.password = password;
-    QString proxyName = proxyServerEdit->text();
-    int port = proxyPortEdit->text().toInt();
-    rqParam.proxyName = proxyName;
-    rqParam.proxyPort = port;
+    if (streaming) {
+        startStreamSegments(rqParam, STREAM_SEGMENT_SIZE);
+        return;
+    }
 
-    int size = filePools.size();
-    quint64 step = totalBytes / size;
+    // Segments need the length up front; an empty body is only trusted when
+    // the server said so.
+    if (!lengthKnown) {
+        failDownload(tr("The server did not report a content length."));
+        return;
+    }
+
+    if (compressedTransfer) {
+        // One compressed stream into the first temp file, the rest are unused.
+        statusLabel->setText(tr("Downloading %1 compressed...").arg(url.toString()));
+        while (filePools.size() > 1) {
+            TEMP_FILE unused = filePools.takeLast();
+            unused.file->close();
+            unused.file->remove();
+            delete unused.file;
+        }
+        rqParam.compressed = true;
+        rqParam.start = 0;
+        rqParam.end = totalBytes - 1;
+        assignAddress(rqParam);
+        DownloadWorker *worker = new DownloadWorker(rqParam, filePools[0]);
+        connect(worker, &DownloadWorker::download_done, this, &HttpWindow::rebuildFile);
+        startWorker(worker);
+        return;
+    }
+
+    // The compression probe already fetched the first bytes, they open the
+    // first temp file and the segments cover the rest.
     quint64 start = 0;
-    quint64 end = step;
-    for (auto item : filePools) {
+    if (!head.isEmpty()) {
+        filePools[0].file->write(head);
+        start = head.size();
+        download_progress(head.size());
+    }
+    const quint64 first = start;
+
+    // Round the step up so the ranges end exactly at the last byte; a body
+    // smaller than the pool leaves the trailing temp files empty.
+    const int size = filePools.size();
+    const quint64 step = (totalBytes - first + size - 1) / size;
+    for (auto &item : filePools) {
+        if (start >= totalBytes) {
+            item.isFinished = true;
+            continue;
+        }
         rqParam.start = start;
-        rqParam.end = end;
+        rqParam.end = qMin(start + step, totalBytes) - 1;
+        assignAddress(rqParam);
 
         DownloadWorker *worker = new DownloadWorker(rqParam, item);
         connect(worker, &DownloadWorker::download_done, this, &HttpWindow::rebuildFile);
-        connect(this, &HttpWindow::cancle_signal, worker, &DownloadWorker::cancle_download_slot);
-        connect(worker, &DownloadWorker::reply_progress, this, &HttpWindow::download_progress);
-        connect(worker, &QThread::finished, worker, &QThread::deleteLater, Qt::QueuedConnection);
+        startWorker(worker);
+        start += step;
+    }
+    if (first >= totalBytes)
+        rebuildFile(QString(), true);
+}
+
+QNetworkRequest HttpWindow::probeRequest(const QUrl &requestedUrl)
+{
+    QNetworkRequest request(requestedUrl);
+    QString concatenated = QStringLiteral("%1:%2").arg(userNameEdit->text(), passEdit->text());
+    QByteArray data = concatenated.toLocal8Bit().toBase64();
+    QString headerData = "Basic " + data;
+    request.setRawHeader("Authorization", headerData.toLocal8Bit());
+    return request;
+}
+
+bool HttpWindow::shouldCompress(const QUrl &requestedUrl, QByteArray *head)
+{
+    if (totalBytes < COMPRESS_MIN_BYTES)
+        return false;
+    const QByteArray type = probeContentType.toLower();
+    const bool compressible = type.startsWith("text/") || type.contains("json") || type.contains("xml")
+        || type.contains("csv") || type.contains("javascript") || type.contains("yaml");
+    if (!compressible)
+        return false;
+
+    // Does the server compress this resource at all? Qt only inflates
+    // gzip and deflate, so br/zstd are not offered.
+    QNetworkRequest request = probeRequest(requestedUrl);
+    request.setRawHeader("Accept-Encoding", "gzip, deflate");
+    QNetworkReply *probe = qnam->head(request);
+    QEventLoop eventLoop;
+    QObject::connect(probe, SIGNAL(finished()), &eventLoop, SLOT(quit()));
+    eventLoop.exec();
+    const QByteArray encoding = probe->rawHeader("Content-Encoding").toLower();
+    probe->deleteLater();
+    if (httpRequestAborted || (!encoding.contains("gzip") && !encoding.contains("deflate")))
+        return false;
+
+    // Fetch the start of the identity body: its transfer time gives the
+    // single-stream rate and zlib gives the ratio gzip would reach. The
+    // bytes are handed back so a segmented download does not fetch them
+    // again.
+    request = probeRequest(requestedUrl);
+    request.setRawHeader("Accept-Encoding", "identity");
+    request.setRawHeader("Range", QStringLiteral("bytes=0-%1").arg(COMPRESS_SAMPLE_BYTES - 1).toLatin1());
+    QElapsedTimer clock;
+    clock.start();
+    probe = qnam->get(request);
+    QObject::connect(probe, SIGNAL(finished()), &eventLoop, SLOT(quit()));
+    eventLoop.exec();
+    const qint64 msecs = qMax<qint64>(clock.elapsed(), 1);
+    const QByteArray sample = probe->readAll();
+    const int status = probe->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    probe->deleteLater();
+    if (httpRequestAborted || status != 206 || sample.size() != COMPRESS_SAMPLE_BYTES)
+        return false;
+    *head = sample;
+
+    const double ratio = double(sample.size()) / qCompress(sample).size();
+    const double singleRate = double(sample.size()) / msecs;
+    // Segments rarely scale with their count; on first contact with a host
+    // assume a modest speed-up until a real download has been measured.
+    const double segmentedRate = hostThroughput.value(requestedUrl.host(), singleRate * SEGMENTED_SPEEDUP_GUESS);
+    const double compressedRate = qMin(singleRate * ratio, INFLATE_BYTES_PER_MS);
+    qDebug() << "Compression probe: ratio " << ratio << " single " << singleRate
+             << " segmented " << segmentedRate << " compressed " << compressedRate;
+    return compressedRate > segmentedRate;
+}
 
-        worker->start();
-        start = end + 1;
-        end = start + step;
+void HttpWindow::resolveAddresses(const REQUEST_PARAM &rqParam)
+{
+    // A proxy resolves the host itself, and a single address has nothing
+    // to spread over; both fall back to connecting by name.
+    addressPool.clear();
+    if (!rqParam.proxyName.isEmpty() && rqParam.proxyPort)
+        return;
+    const quint16 port = rqParam.url.port(rqParam.url.scheme() == QLatin1String("https") ? 443 : 80);
+    addressPool.resolve(rqParam.url.host(), port);
+}
+
+REQUEST_PARAM HttpWindow::requestParam(const QUrl &requestedUrl)
+{
+    REQUEST_PARAM rqParam;
+    rqParam.url = requestedUrl;
+    rqParam.user = userNameEdit->text();
+    rqParam.password = passEdit->text();
+    rqParam.proxyName = proxyServerEdit->text();
+    rqParam.proxyPort = proxyPortEdit->text().toInt();
+    return rqParam;
+}
+
+void HttpWindow::addDownloadRow(const QString &fileName)
+{
+    currentRow = downloadModel->addDownload(url, fileName);
+    downloadModel->setState(currentRow, DOWNLOAD_RUNNING);
+    downloadView->scrollToBottom();
+    cancelButton->setEnabled(true);
+    jobPaused = false;
+    updatePauseButton();
+}
+
+void HttpWindow::downloadDone()
+{
+    cancelButton->setEnabled(false);
+    downloadButton->setEnabled(!urlLineEdit->text().isEmpty());
+    batchButton->setEnabled(true);
+    jobPaused = false;
+    updatePauseButton();
+    // Failures that still end the job have already marked their row.
+    const DOWNLOAD_STATE state = downloadModel->state(currentRow);
+    if (state != DOWNLOAD_RUNNING && state != DOWNLOAD_PAUSED)
+        return;
+    downloadModel->setProgress(currentRow, totalBytes, totalBytes);
+    downloadModel->setState(currentRow, DOWNLOAD_FINISHED);
+}
+
+void HttpWindow::streamRequest(const QUrl &requestedUrl, QIODevice *device)
+{
+    setStreamOutput(device);
+    file = nullptr;
+    filePools.clear();
+    QString fileName = requestedUrl.fileName();
+    if (fileName.isEmpty())
+        fileName = defaultFileName;
+    // Runs for the same name must not share segment files.
+    streamTempDir.reset(new QTemporaryDir);
+    if (!streamTempDir->isValid()) {
+        qWarning() << "Unable to create a temporary directory: " << streamTempDir->errorString();
+        emit cancle_signal();
+        return;
     }
+    streamTempBase = streamTempDir->filePath(fileName);
+    downloadButton->setEnabled(false);
+    batchButton->setEnabled(false);
+    startRequest(requestedUrl);
+}
+
+void HttpWindow::setStreamOutput(QIODevice *device)
+{
+    streamDevice = device;
+}
+
+void HttpWindow::setStreamCallback(std::function<void(const QByteArray &)> callback)
+{
+    streamCallback = callback;
+}
+
+void HttpWindow::startStreamSegments(const REQUEST_PARAM &rqParam, quint64 segmentSize)
+{
+    clearStreamSegments();
+    if (!totalBytes) {
+        failDownload(tr("The server did not report a content length."));
+        return;
+    }
+    streamParam = rqParam;
+    streamParam.streaming = true;
+    for (quint64 start = 0; start < totalBytes; start += segmentSize) {
+        STREAM_SEGMENT segment;
+        segment.start = start;
+        segment.end = qMin(start + segmentSize, totalBytes) - 1;
+        // Named by range, so late signals of an abandoned layout never
+        // match a segment of the next one.
+        segment.tempFileName = streamTempBase + QStringLiteral("_%1-%2").arg(segment.start).arg(segment.end);
+        streamSegments.push_back(segment);
+    }
+    scheduleStreamSegments();
+}
+
+void HttpWindow::scheduleStreamSegments()
+{
+    // Always start the lowest pending segment so the ones just ahead of the
+    // read cursor get bandwidth first, and never run past the window.
+    if (jobPaused || streamCursor >= streamSegments.size())
+        return;
+    const quint64 limit = streamSegments[streamCursor].start + streamWindowBytes;
+    for (int i = streamCursor; i < streamSegments.size() && streamRunning < STREAM_MAX_WORKERS; i++) {
+        if (streamSegments[i].start >= limit)
+            break;
+        if (!streamSegments[i].isStarted)
+            startStreamSegment(i);
+    }
+}
+
+void HttpWindow::startStreamSegment(int index)
+{
+    STREAM_SEGMENT &segment = streamSegments[index];
+    segment.tempFile = TEMP_FILE(openFileForWrite(segment.tempFileName));
+    if (!segment.tempFile.file) {
+        cancelDownload();
+        return;
+    }
+    segment.isStarted = true;
+    streamRunning++;
+
+    // At most STREAM_MAX_WORKERS segments run, so the pool never grows past
+    // that; idle workers keep their connection for the next segment.
+    DownloadWorker *worker = pickWorker();
+    if (worker) {
+        worker->setIdle(false);
+        const quint64 start = segment.start;
+        const quint64 end = segment.end;
+        QFile *tempFile = segment.tempFile.file;
+        QMetaObject::invokeMethod(worker, [worker, start, end, tempFile]() {
+            worker->fetchRange(start, end, tempFile);
+        }, Qt::QueuedConnection);
+    } else {
+        REQUEST_PARAM rqParam = streamParam;
+        rqParam.start = segment.start;
+        rqParam.end = segment.end;
+        assignAddress(rqParam);
+        worker = new DownloadWorker(rqParam, segment.tempFile);
+        connect(worker, &DownloadWorker::download_done, this, &HttpWindow::streamSegmentDone);
+        connect(worker, &DownloadWorker::range_ignored, this, &HttpWindow::streamRangeIgnored);
+        connect(worker, &DownloadWorker::reply_progress, this, &HttpWindow::pumpStream);
+        startWorker(worker);
+    }
+    segment.worker = worker;
+}
+
+void HttpWindow::streamSegmentDone(const QString &fileName, bool ok)
+{
+    if (httpRequestAborted)
+        return;
+    bool found = false;
+    for (auto &segment : streamSegments) {
+        if (segment.isStarted && segment.tempFileName == fileName) {
+            if (segment.worker)
+                segment.worker->setIdle(true);
+            segment.tempFile.isFinished = true;
+            streamRunning--;
+            found = true;
+            break;
+        }
+    }
+    if (!found)
+        return;
+    if (!ok) {
+        // The worker has already retried; a hole in the stream would reach
+        // the consumer unnoticed, so fail the whole job instead.
+        qDebug() << "Stream segment failed: " << fileName;
+        failDownload(tr("Part of %1 could not be fetched.").arg(url.toString()));
+        return;
+    }
+    pumpStream();
+}
+
+void HttpWindow::streamRangeIgnored(const QString &fileName)
+{
+    // Without range support one GET of the whole body still arrives in
+    // order. Switching is only safe while nothing reached the consumer.
+    if (httpRequestAborted || streamSegments.size() < 2 || streamDelivered)
+        return;
+    qDebug() << "Server ignored the range for " << fileName << ", streaming with one request";
+    stopWorkers();
+    clearStreamSegments();
+    startStreamSegments(streamParam, totalBytes);
+}
+
+void HttpWindow::pumpStream()
+{
+    if (httpRequestAborted || streamSegments.isEmpty())
+        return;
+    while (streamCursor < streamSegments.size()) {
+        STREAM_SEGMENT &segment = streamSegments[streamCursor];
+        if (!segment.isStarted)
+            break;
+        if (!segment.reader) {
+            segment.reader = new QFile(segment.tempFileName);
+            if (!segment.reader->open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+                delete segment.reader;
+                segment.reader = nullptr;
+                break;
+            }
+        }
+        const QByteArray chunk = segment.reader->readAll();
+        if (!chunk.isEmpty())
+            writeStreamChunk(chunk);
+        if (!segment.tempFile.isFinished)
+            break;
+
+        // The worker has returned, so the segment is fully on disk and drained.
+        segment.reader->close();
+        delete segment.reader;
+        segment.reader = nullptr;
+        segment.tempFile.file->close();
+        segment.tempFile.file->remove();
+        delete segment.tempFile.file;
+        segment.tempFile.file = nullptr;
+        streamCursor++;
+    }
+    if (streamCursor == streamSegments.size()) {
+        finishStream();
+        return;
+    }
+    scheduleStreamSegments();
+}
+
+void HttpWindow::writeStreamChunk(const QByteArray &chunk)
+{
+    streamDelivered += chunk.size();
+    contentHash.addData(chunk);
+    if (file)
+        file->write(chunk);
+    if (streamDevice)
+        streamDevice->write(chunk);
+    if (streamCallback)
+        streamCallback(chunk);
+}
+
+void HttpWindow::finishStream()
+{
+    qDebug() << "Stream done";
+    releaseStreamWorkers();
+    streamSegments.clear();
+    streamCursor = 0;
+    streamRunning = 0;
+    if (file) {
+        const QString fileName = file->fileName();
+        file->close();
+        delete file;
+        file = nullptr;
+        storeInCache(fileName);
+    }
+    statusLabel->setText(tr("Streamed %1 bytes from %2").arg(totalBytes).arg(url.toString()));
+    downloadButton->setEnabled(true);
+    batchButton->setEnabled(true);
+    emit download_done_signal();
+}
+
+void HttpWindow::releaseStreamWorkers()
+{
+    for (auto worker : downloadWorkerPools) {
+        if (worker && worker->isIdle()) {
+            QMetaObject::invokeMethod(worker, [worker]() {
+                worker->fetchRange(0, 0, nullptr);
+            }, Qt::QueuedConnection);
+        }
+    }
+    downloadWorkerPools.clear();
+}
+
+void HttpWindow::clearStreamSegments()
+{
+    // Called once the workers have stopped, so every temp file is ours.
+    for (auto &segment : streamSegments) {
+        if (segment.reader) {
+            segment.reader->close();
+            delete segment.reader;
+        }
+        if (segment.tempFile.file) {
+            segment.tempFile.file->close();
+            segment.tempFile.file->remove();
+            delete segment.tempFile.file;
+        }
+    }
+    streamSegments.clear();
+    streamCursor = 0;
+    streamRunning = 0;
+    streamDelivered = 0;
+}
+
+bool HttpWindow::finishFromCache()
+{
+    qDebug() << "Cache hit: " << url.toString();
+    if (streamDevice || streamCallback) {
+        QFile cached(artifactCache()->objectPath(cacheEntry.hash));
+        if (!cached.open(QIODevice::ReadOnly))
+            return false;
+        totalBytes = cached.size();
+        addDownloadRow(file ? file->fileName() : url.fileName());
+        while (!cached.atEnd())
+            writeStreamChunk(cached.read(STREAM_SEGMENT_SIZE));
+        cacheHit = true;
+        finishStream();
+        return true;
+    }
+    if (!file)
+        return false;
+
+    const QString fileName = file->fileName();
+    file->close();
+    if (!artifactCache()->materialize(cacheEntry.hash, fileName)) {
+        qDebug() << "Cache materialize failed, downloading " << url.toString();
+        file->open(QIODevice::WriteOnly);
+        return false;
+    }
+    delete file;
+    file = nullptr;
+    discardTempFiles();
+
+    QFileInfo fi(fileName);
+    totalBytes = fi.size();
+    addDownloadRow(fileName);
+    statusLabel->setText(tr("Restored %1 bytes from cache to %2\nin\n%3")
+        .arg(fi.size()).arg(fi.fileName(), QDir::toNativeSeparators(fi.absolutePath())));
+    if (launchCheckBox->isChecked())
+        QDesktopServices::openUrl(QUrl::fromLocalFile(fi.absoluteFilePath()));
+    downloadButton->setEnabled(true);
+    batchButton->setEnabled(true);
+    emit download_done_signal();
+    return true;
+}
+
+void HttpWindow::storeInCache(const QString &fileName)
+{
+    // A short body or an error page would be served for every later 304,
+    // so only complete downloads of the advertised size go in.
+    if (!cacheCheckBox->isChecked() || cacheHit || !segmentsOk || !totalBytes
+        || quint64(QFileInfo(fileName).size()) != totalBytes)
+        return;
+    const QUrl cacheUrl = url;
+    const QByteArray eTag = probeETag;
+    const QByteArray lastModified = probeLastModified;
+    const QByteArray hash = contentHash.result().toHex();
+    const QString target = artifactCache()->objectPath(hash);
+    if (artifactCache()->contains(hash)) {
+        artifactCache()->insert(cacheUrl, eTag, lastModified, fileName, hash);
+        return;
+    }
+    // Without reflinks this is a full copy, keep it off the GUI thread and
+    // only update the index once the object is in place.
+    QThread *store = QThread::create([fileName, target]() {
+        ArtifactCache::storeObject(fileName, target);
+    });
+    connect(store, &QThread::finished, this, [this, store, cacheUrl, eTag, lastModified, fileName, hash, target]() {
+        store->deleteLater();
+        if (QFile::exists(target))
+            artifactCache()->insert(cacheUrl, eTag, lastModified, fileName, hash);
+    });
+    store->start();
+}
+
+void HttpWindow::discardTempFiles()
+{
+    for (auto item : filePools) {
+        if (!item.file)
+            continue;
+        item.file->close();
+        item.file->remove();
+        delete item.file;
+    }
+    filePools.clear();
+}
+
+QByteArray HttpWindow::getControlFile(const QUrl &controlUrl)
+{
+    QNetworkRequest request = probeRequest(controlUrl);
+    request.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, QVariant(true));
+    QNetworkReply *controlReply = qnam->get(request);
+    QEventLoop eventLoop;
+    QObject::connect(controlReply, SIGNAL(finished()), &eventLoop, SLOT(quit()));
+    eventLoop.exec();
+    QByteArray body;
+    if (controlReply->error() == QNetworkReply::NoError)
+        body = controlReply->readAll();
+    controlReply->deleteLater();
+    return body;
+}
+
+bool HttpWindow::startDelta(const QUrl &requestedUrl, const QString &fileName)
+{
+    // Fetching the control file and scanning spin nested event loops while
+    // the scanner thread uses deltaControl and deltaOut; nothing may start
+    // another job until the transfer is set up.
+    if (deltaPreparing)
+        return true;
+    deltaPreparing = true;
+    downloadButton->setEnabled(false);
+    batchButton->setEnabled(false);
+
+    // The control file is published next to the target, as zsyncmake does.
+    QUrl controlUrl = requestedUrl;
+    controlUrl.setPath(requestedUrl.path() + QStringLiteral(".zsync"));
+    deltaControl = ZsyncControl();
+    const QByteArray control = getControlFile(controlUrl);
+    if (control.isEmpty() || !deltaControl.parse(control)) {
+        qDebug() << "No usable zsync control file at " << controlUrl.toString();
+        deltaPreparing = false;
+        downloadButton->setEnabled(true);
+        batchButton->setEnabled(true);
+        return false;
+    }
+    url = requestedUrl;
+    const QUrl rangeUrl = deltaControl.url().isEmpty()
+        ? requestedUrl
+        : controlUrl.resolved(QUrl(deltaControl.url()));
+
+    deltaTarget = fileName;
+    deltaOut = new QFile(fileName + QStringLiteral(".zsync-part"));
+    if (!deltaOut->open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+        delete deltaOut;
+        deltaOut = nullptr;
+        deltaPreparing = false;
+        downloadButton->setEnabled(true);
+        batchButton->setEnabled(true);
+        return false;
+    }
+    deltaOut->resize(deltaControl.length());
+
+    // Scanning a large image takes a while, keep the window responsive.
+    statusLabel->setText(tr("Scanning %1 for reusable blocks...").arg(fileName));
+    QVector<qint64> matches;
+    quint64 reused = 0;
+    QThread *scanner = QThread::create([&]() {
+        matches = deltaControl.matchLocal(fileName);
+        reused = deltaControl.copyMatches(fileName, matches, deltaOut);
+    });
+    QEventLoop scanLoop;
+    QObject::connect(scanner, &QThread::finished, &scanLoop, &QEventLoop::quit);
+    scanner->start();
+    scanLoop.exec();
+    delete scanner;
+    deltaPreparing = false;
+
+    deltaParam = requestParam(rangeUrl);
+    resolveAddresses(deltaParam);
+    deltaBatches.clear();
+    deltaRunning = 0;
+    deltaDone = 0;
+    DELTA_BATCH deltaBatch;
+    quint64 batchBytes = 0;
+    for (const BYTE_RANGE &range : deltaControl.missingRanges(matches)) {
+        deltaBatch.ranges.push_back(range);
+        batchBytes += range.second - range.first + 1;
+        if (deltaBatch.ranges.size() == DELTA_RANGES_PER_REQUEST || batchBytes >= DELTA_BATCH_BYTES) {
+            deltaBatches.push_back(deltaBatch);
+            deltaBatch = DELTA_BATCH();
+            batchBytes = 0;
+        }
+    }
+    if (!deltaBatch.ranges.isEmpty())
+        deltaBatches.push_back(deltaBatch);
+    for (int i = 0; i < deltaBatches.size(); i++)
+        deltaBatches[i].tempFileName = fileName + QStringLiteral("_d%1").arg(i);
+
+    totalBytes = deltaControl.length() - reused;
+    currentBytes = 0;
+    httpRequestAborted = false;
+    file = nullptr;
+    qDebug() << "Delta: reusing " << reused << " of " << deltaControl.length() << " bytes";
+    statusLabel->setText(tr("Delta update of %1: reusing %2 of %3 bytes...")
+        .arg(fileName).arg(reused).arg(deltaControl.length()));
+    addDownloadRow(fileName);
+    if (deltaBatches.isEmpty())
+        finishDelta();
+    else
+        scheduleDeltaBatches();
+    return true;
+}
+
+void HttpWindow::scheduleDeltaBatches()
+{
+    if (jobPaused)
+        return;
+    for (auto &deltaBatch : deltaBatches) {
+        if (deltaRunning >= DELTA_MAX_WORKERS)
+            break;
+        if (deltaBatch.isStarted)
+            continue;
+        deltaBatch.tempFile = TEMP_FILE(openFileForWrite(deltaBatch.tempFileName));
+        if (!deltaBatch.tempFile.file) {
+            cancelDownload();
+            return;
+        }
+        deltaBatch.isStarted = true;
+        deltaRunning++;
+
+        REQUEST_PARAM rqParam = deltaParam;
+        assignAddress(rqParam);
+        QStringList ranges;
+        for (const BYTE_RANGE &range : deltaBatch.ranges)
+            ranges << QStringLiteral("%1-%2").arg(range.first).arg(range.second);
+        rqParam.rangeSpec = QStringLiteral("bytes=") + ranges.join(',');
+        DownloadWorker *worker = new DownloadWorker(rqParam, deltaBatch.tempFile);
+        connect(worker, &DownloadWorker::download_header, this, &HttpWindow::deltaBatchHeader);
+        connect(worker, &DownloadWorker::download_done, this, &HttpWindow::deltaBatchDone);
+        startWorker(worker);
+    }
+}
+
+void HttpWindow::deltaBatchHeader(const QString &fileName, const QByteArray &contentType, int status)
+{
+    for (auto &deltaBatch : deltaBatches) {
+        if (deltaBatch.isStarted && deltaBatch.tempFileName == fileName) {
+            deltaBatch.contentType = contentType;
+            deltaBatch.status = status;
+            break;
+        }
+    }
+}
+
+void HttpWindow::deltaBatchDone(const QString &fileName, bool complete)
+{
+    if (httpRequestAborted || !deltaOut)
+        return;
+    for (auto &deltaBatch : deltaBatches) {
+        if (!deltaBatch.isStarted || deltaBatch.tempFileName != fileName)
+            continue;
+        deltaBatch.tempFile.file->close();
+        // A server that ignores Range answers 200 with the whole file.
+        const bool ok = complete && (deltaBatch.status == 206 || deltaBatch.status == 200)
+            && deltaControl.writeRangeResponse(deltaBatch.tempFileName, deltaBatch.contentType,
+                   deltaBatch.ranges, deltaBatch.status == 200, deltaOut);
+        deltaBatch.tempFile.file->remove();
+        delete deltaBatch.tempFile.file;
+        deltaBatch.tempFile.file = nullptr;
+        deltaRunning--;
+        deltaDone++;
+        if (!ok) {
+            qDebug() << "Delta: bad range response " << deltaBatch.status << deltaBatch.contentType;
+            failDownload(tr("The server did not return the requested ranges."));
+            return;
+        }
+        break;
+    }
+    if (deltaDone == deltaBatches.size())
+        finishDelta();
+    else
+        scheduleDeltaBatches();
+}
+
+void HttpWindow::finishDelta()
+{
+    const bool ok = deltaControl.verify(deltaOut);
+    deltaOut->close();
+    if (ok) {
+        // Move the old file aside first, so a failed rename can put it back.
+        const QString backup = deltaTarget + QStringLiteral(".zsync-old");
+        QFile::remove(backup);
+        const bool movedAside = QFile::rename(deltaTarget, backup);
+        if (movedAside && QFile::rename(deltaOut->fileName(), deltaTarget)) {
+            QFile::remove(backup);
+            QFileInfo fi(deltaTarget);
+            statusLabel->setText(tr("Updated %1 bytes (%2 fetched) in %3\nin\n%4")
+                .arg(fi.size()).arg(totalBytes).arg(fi.fileName(), QDir::toNativeSeparators(fi.absolutePath())));
+        } else {
+            if (movedAside)
+                QFile::rename(backup, deltaTarget);
+            downloadModel->setState(currentRow, DOWNLOAD_FAILED);
+            statusLabel->setText(tr("Delta update failed:\nUnable to replace %1, the new version is in %2.")
+                .arg(deltaTarget, deltaOut->fileName()));
+        }
+    } else {
+        deltaOut->remove();
+        downloadModel->setState(currentRow, DOWNLOAD_FAILED);
+        statusLabel->setText(tr("Delta update failed:\nChecksum mismatch, %1 is unchanged.").arg(deltaTarget));
+    }
+    delete deltaOut;
+    deltaOut = nullptr;
+    deltaBatches.clear();
+    downloadButton->setEnabled(true);
+    batchButton->setEnabled(true);
+    emit download_done_signal();
+}
+
+void HttpWindow::clearDelta()
+{
+    for (auto &deltaBatch : deltaBatches) {
+        if (deltaBatch.tempFile.file) {
+            deltaBatch.tempFile.file->close();
+            deltaBatch.tempFile.file->remove();
+            delete deltaBatch.tempFile.file;
+        }
+    }
+    if (deltaOut) {
+        deltaOut->close();
+        deltaOut->remove();
+        delete deltaOut;
+        deltaOut = nullptr;
+    }
+    deltaBatches.clear();
+    deltaRunning = 0;
+    deltaDone = 0;
 }
 
 void HttpWindow::downloadFile()
@@ -367,6 +1534,8 @@ void HttpWindow::downloadFile()
     if (useDirectory)
         fileName.prepend(downloadDirectory + '/');
     if (QFile::exists(fileName)) {
+        if (deltaCheckBox->isChecked() && startDelta(newUrl, fileName))
+            return;
         if (QMessageBox::question(this, tr("Overwrite Existing File"),
             tr("There already exists a file called %1%2."
                 " Overwrite?")
@@ -384,24 +1553,163 @@ void HttpWindow::downloadFile()
 
     file = openFileForWrite(fileName);
     filePools.clear();
-    for (int i = 0 ; i < 20; i++) {
-        QString tempFileName = fileName;
-        tempFileName.append(QStringLiteral("_%1").arg(i));
-        filePools.push_back(TEMP_FILE(openFileForWrite(tempFileName)));
+    if (streamCheckBox->isChecked()) {
+        // Segments are created on demand by the stream scheduler and the
+        // target file is written in order, so no rebuild pass is needed.
+        if (!standardOutput) {
+            standardOutput = new QFile(this);
+            standardOutput->open(stdout, QIODevice::WriteOnly | QIODevice::Unbuffered);
+        }
+        setStreamOutput(standardOutput);
+        streamTempBase = fileName;
+    } else {
+        setStreamOutput(nullptr);
+        for (int i = 0 ; i < 20; i++) {
+            QString tempFileName = fileName;
+            tempFileName.append(QStringLiteral("_%1").arg(i));
+            filePools.push_back(TEMP_FILE(openFileForWrite(tempFileName)));
+        }
     }
     if (!file)
         return;
 
+    // One job at a time: a batch shares url, Cancel and the abort flag.
     downloadButton->setEnabled(false);
+    batchButton->setEnabled(false);
 
     // schedule the request
     startRequest(newUrl);
 }
 
+void HttpWindow::downloadBatch()
+{
+    bool ok = false;
+    const QString text = QInputDialog::getMultiLineText(this, tr("Batch download"),
+        tr("URLs of small files on the same server, one per line:"), QString(), &ok);
+    if (!ok)
+        return;
+
+    QString downloadDirectory = QDir::cleanPath(downloadDirectoryLineEdit->text().trimmed());
+    if (downloadDirectory.isEmpty() || !QFileInfo(downloadDirectory).isDir())
+        downloadDirectory = QDir::currentPath();
+    QList<BATCH_ITEM> items;
+    QSet<QString> names;
+    QUrl origin;
+    int foreign = 0;
+    const QStringList lines = text.split('\n', Qt::SkipEmptyParts);
+    for (const QString &line : lines) {
+        const QUrl itemUrl = QUrl::fromUserInput(line.trimmed());
+        if (!itemUrl.isValid())
+            continue;
+        // Credentials and proxy settings are meant for the first URL's
+        // server, never send them anywhere else.
+        if (origin.isEmpty())
+            origin = itemUrl;
+        if (itemUrl.scheme() != origin.scheme() || itemUrl.host() != origin.host()
+            || itemUrl.port() != origin.port()) {
+            foreign++;
+            continue;
+        }
+        QString fileName = itemUrl.fileName();
+        if (fileName.isEmpty())
+            fileName = defaultFileName;
+        // Different paths may end in the same name, keep every file.
+        const QString baseName = fileName;
+        for (int i = 1; names.contains(fileName); i++)
+            fileName = QStringLiteral("%1_%2").arg(baseName).arg(i);
+        names.insert(fileName);
+        BATCH_ITEM item;
+        item.url = itemUrl;
+        item.fileName = downloadDirectory + '/' + fileName;
+        items.push_back(item);
+    }
+    if (foreign) {
+        QMessageBox::information(this, tr("Batch download"),
+            tr("%1 URLs are not on %2 and were skipped.")
+            .arg(foreign).arg(origin.adjusted(QUrl::RemovePath | QUrl::RemoveQuery | QUrl::RemoveFragment
+                | QUrl::RemoveUserInfo).toString()));
+    }
+    if (items.isEmpty())
+        return;
+
+    QStringList existing;
+    for (const BATCH_ITEM &item : items) {
+        if (QFile::exists(item.fileName))
+            existing << QFileInfo(item.fileName).fileName();
+    }
+    if (!existing.isEmpty()) {
+        if (QMessageBox::question(this, tr("Overwrite Existing Files"),
+            tr("%1 of these files already exist in %2 (%3)."
+                " Overwrite?")
+            .arg(existing.size())
+            .arg(QDir::toNativeSeparators(downloadDirectory), existing.mid(0, 3).join(QStringLiteral(", "))),
+            QMessageBox::Yes | QMessageBox::No,
+            QMessageBox::No)
+            == QMessageBox::No) {
+            return;
+        }
+    }
+
+    url = items.first().url;
+    httpRequestAborted = false;
+    downloadButton->setEnabled(false);
+    batchButton->setEnabled(false);
+    batch = new BatchDownloader(requestParam(url), this);
+    connect(batch, &BatchDownloader::item_progress, this, &HttpWindow::batchItemProgress);
+    connect(batch, &BatchDownloader::item_finished, this, &HttpWindow::batchItemFinished);
+    connect(batch, &BatchDownloader::finished, this, &HttpWindow::batchFinished);
+    QList<QUrl> urls;
+    QStringList fileNames;
+    for (const BATCH_ITEM &item : items) {
+        urls << item.url;
+        fileNames << item.fileName;
+    }
+    batchFirstRow = downloadModel->addDownloads(urls, fileNames);
+    cancelButton->setEnabled(true);
+    batchPaused = false;
+    statusLabel->setText(tr("Downloading %1 files from %2...").arg(items.size()).arg(url.host()));
+    batch->start(items);
+    updatePauseButton();
+}
+
+void HttpWindow::batchItemProgress(int index, qint64 bytes, qint64 total)
+{
+    downloadModel->setProgress(batchFirstRow + index, bytes, qMax(total, qint64(0)));
+}
+
+void HttpWindow::batchItemFinished(int index, bool ok)
+{
+    if (downloadModel->state(batchFirstRow + index) == DOWNLOAD_CANCELED)
+        return;
+    downloadModel->setState(batchFirstRow + index, ok ? DOWNLOAD_FINISHED : DOWNLOAD_FAILED);
+}
+
+void HttpWindow::batchFinished(int failed)
+{
+    batch->deleteLater();
+    batch = nullptr;
+    downloadButton->setEnabled(true);
+    batchButton->setEnabled(true);
+    cancelButton->setEnabled(false);
+    batchPaused = false;
+    updatePauseButton();
+    if (httpRequestAborted)
+        return;
+    if (failed)
+        statusLabel->setText(tr("Batch download finished, %1 files failed.").arg(failed));
+    else
+        statusLabel->setText(tr("Batch download finished."));
+}
+
 QFile *HttpWindow::openFileForWrite(const QString &fileName)
 {
     QScopedPointer<QFile> file(new QFile(fileName));
     if (!file->open(QIODevice::WriteOnly)) {
+        // Pipe mode never shows the window, nobody could answer a dialog.
+        if (!isVisible()) {
+            qWarning() << "Unable to save the file " << fileName << ": " << file->errorString();
+            return nullptr;
+        }
         QMessageBox::information(this, tr("Error"),
             tr("Unable to save the file %1: %2.")
             .arg(QDir::toNativeSeparators(fileName),
@@ -429,22 +1737,49 @@ void HttpWindow::cancelDownload()
         qDebug() << "The request is already cancled";
         return;
     }
-    qDebug() << "Cancle download: " << this->file->fileName();
+    qDebug() << "Cancle download: " << (this->file ? this->file->fileName() : url.toString());
     statusLabel->setText(tr("Download canceled."));
     httpRequestAborted = true;
     //reply->abort();
     downloadButton->setEnabled(true);
+    batchButton->setEnabled(true);
     if (this->file) {
         file->close();
         file->remove();
         delete file;
         file = nullptr;
     }
+    cancelButton->setEnabled(false);
+    const DOWNLOAD_STATE state = downloadModel->state(currentRow);
+    if (state == DOWNLOAD_RUNNING || state == DOWNLOAD_PAUSED)
+        downloadModel->setState(currentRow, DOWNLOAD_CANCELED);
+    stopWorkers();
     emit cancle_signal();
+    discardTempFiles();
+    clearStreamSegments();
+    clearDelta();
+    if (batch) {
+        for (int row = batchFirstRow; row < downloadModel->rowCount(); row++) {
+            const DOWNLOAD_STATE batchState = downloadModel->state(row);
+            if (batchState == DOWNLOAD_QUEUED || batchState == DOWNLOAD_RUNNING || batchState == DOWNLOAD_PAUSED)
+                downloadModel->setState(row, DOWNLOAD_CANCELED);
+        }
+        batch->abort();
+    }
+    jobPaused = false;
+    batchPaused = false;
+    updatePauseButton();
 }
 
-void HttpWindow::rebuildFile(const QString &fileName) {
+void HttpWindow::rebuildFile(const QString &fileName, bool ok) {
     qDebug() << "Rebuild file";
+    if (httpRequestAborted) {
+        return;
+    }
+    if (!ok) {
+        qDebug() << "Segment failed: " << fileName;
+        segmentsOk = false;
+    }
     int count = 0;
     int size = filePools.size();
     for (auto &item : filePools) {
@@ -456,21 +1791,32 @@ void HttpWindow::rebuildFile(const QString &fileName) {
         }
     }
     if (count == size) {
+        if (!segmentsOk) {
+            // Nothing of a short body or an error page stays on disk.
+            failDownload(tr("The server did not return all of %1.").arg(url.toString()));
+            return;
+        }
         for (auto item : filePools) {
                 item.file->flush();
                 item.file->close();
                 QString fileNameTemp = item.file->fileName();
                 auto tempFile = openFileForRead(fileNameTemp);
-                this->file->write(tempFile->readAll());
+                const QByteArray data = tempFile->readAll();
+                contentHash.addData(data);
+                this->file->write(data);
                 tempFile->close();
                 delete tempFile;
                 item.file->remove();
                 delete item.file;
         }
         filePools.clear();
+        if (!compressedTransfer && segmentsOk && downloadClock.isValid() && downloadClock.elapsed() > 0)
+            hostThroughput.insert(url.host(), double(totalBytes) / downloadClock.elapsed());
+        const QString targetName = file->fileName();
         file->close();
         delete file;
         file = nullptr;
+        storeInCache(targetName);
         emit download_done_signal();
     }
 }
@@ -550,7 +1896,9 @@ void HttpWindow::httpReadyRead()
 
 void HttpWindow::enableDownloadButton()
 {
-    downloadButton->setEnabled(!urlLineEdit->text().isEmpty());
+    // Batch... is only disabled while a job runs, which Download must not
+    // interrupt either.
+    downloadButton->setEnabled(!urlLineEdit->text().isEmpty() && batchButton->isEnabled());
 }
 
 void HttpWindow::slotAuthenticationRequired(QNetworkReply *, QAuthenticator *authenticator)
@@ -573,13 +1921,11 @@ void HttpWindow::slotAuthenticationRequired(QNetworkReply *, QAuthenticator *aut
 }
 
 void HttpWindow::download_progress(qint64 bytesRead) {
-   qDebug() << "HttpWindow download_progress " << bytesRead;
    if (this->httpRequestAborted) {
-       qDebug() << "HttpWindow download_progress: Request is cancled";
        return;
    }
    currentBytes += bytesRead;
-   emit download_progress_signal(currentBytes, this->totalBytes);
+   downloadModel->setProgress(currentRow, currentBytes, this->totalBytes);
 }
 
 #ifndef QT_NO_SSL
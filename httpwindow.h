@@ -51,10 +51,21 @@
 #ifndef HTTPWINDOW_H
 #define HTTPWINDOW_H
 
-#include <QProgressDialog>
+#include <QDialog>
 #include <QNetworkAccessManager>
+#include <QCryptographicHash>
 #include <QUrl>
 #include <QThread>
+#include <QPointer>
+#include <QScopedPointer>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QHash>
+#include <functional>
+
+#include "addresspool.h"
+#include "artifactcache.h"
+#include "zsyncdelta.h"
 
 QT_BEGIN_NAMESPACE
 class QFile;
@@ -65,27 +76,30 @@ class QSslError;
 class QAuthenticator;
 class QNetworkReply;
 class QCheckBox;
+class QIODevice;
+class QEventLoop;
+class QTimer;
+class QTemporaryDir;
 
 QT_END_NAMESPACE
 
-class ProgressDialog : public QProgressDialog {
-    Q_OBJECT
-
-public:
-    explicit ProgressDialog(const QUrl &url, QWidget *parent = nullptr);
-
-public slots:
-    void networkReplyProgress(qint64 bytesRead, qint64 totalBytes);
-};
+class BatchDownloader;
+class DownloadWorker;
+class DownloadListModel;
+class DownloadListView;
 
 struct REQUEST_PARAM {
     QUrl url;
     QString user;
     QString password;
-    quint64 start;
-    quint64 end;
+    quint64 start = 0;
+    quint64 end = 0;
     QString proxyName;
     int proxyPort;
+    bool streaming = false;
+    bool compressed = false;
+    QString rangeSpec;
+    QStringList addresses;
 };
 
 struct TEMP_FILE {
@@ -96,6 +110,28 @@ struct TEMP_FILE {
     };
 };
 
+// One fixed-size range of a streamed download. Segments are fetched into
+// their own temp file and drained, strictly in order, by the read cursor.
+struct STREAM_SEGMENT {
+    quint64 start = 0;
+    quint64 end = 0;
+    QString tempFileName;
+    TEMP_FILE tempFile;
+    QFile *reader = nullptr;
+    QPointer<DownloadWorker> worker;
+    bool isStarted = false;
+};
+
+// A group of missing ranges fetched with one multi-range request.
+struct DELTA_BATCH {
+    QVector<BYTE_RANGE> ranges;
+    QString tempFileName;
+    TEMP_FILE tempFile;
+    QByteArray contentType;
+    int status = 0;
+    bool isStarted = false;
+};
+
 class DownloadWorker : public QThread
 {
     Q_OBJECT
@@ -106,25 +142,58 @@ public:
     void setFile(QFile *file) {
         this->tempFile.file = file;
     }
+    // Idle workers of a stream wait for their next range. Only the GUI
+    // thread looks at this flag.
     bool isIdle() {
-        return !this->tempFile.file;
+        return this->idle;
+    }
+    void setIdle(bool idle) {
+        this->idle = idle;
     }
     void run() override;
 public slots:
+    void fetchRange(quint64 start, quint64 end, QFile *file);
     void readyRead();
     void doneRead();
     void cancle_download_slot();
+    void pause_download_slot();
+    void resume_download_slot();
+private slots:
+    void replyFinished();
+    void pauseTimeout();
 signals:
-    void download_done(const QString &fileName);
+    void download_done(const QString &fileName, bool ok);
+    void range_ignored(const QString &fileName);
+    void download_header(const QString &fileName, const QByteArray &contentType, int status);
     void reply_progress(qint64 bytesRead);
+    void address_stats(const QString &assigned, const QString &used, qint64 bytes, qint64 msecs);
+    void address_failed(const QString &address);
     void cancle_download_signal();
 
 protected:
     QNetworkAccessManager qnam;
     REQUEST_PARAM rqParam;
     TEMP_FILE tempFile;
-    QNetworkReply *reply;
+    void startReply();
+    void reportProgress(qint64 bytes, bool flush);
+    bool rangeAccepted() const;
+    bool replyOk() const;
+    bool rangeIgnored() const;
+    bool retryRange();
+    void finishRange();
+
+    QNetworkReply *reply = nullptr;
+    QEventLoop *waitingLoop = nullptr;
+    QTimer *pauseTimer = nullptr;
+    quint64 written = 0;
+    int addressIndex = 0;
+    int retries = 0;
+    QElapsedTimer clock;
+    QElapsedTimer progressClock;
+    qint64 unreported = 0;
     bool isCancle = false;
+    bool isPaused = false;
+    bool idle = false;
 };
 
 
@@ -134,27 +203,76 @@ class HttpWindow : public QDialog
 
 public:
     explicit HttpWindow(QWidget *parent = nullptr);
+    ~HttpWindow();
 
     void startRequest(const QUrl &requestedUrl);
+    void streamRequest(const QUrl &requestedUrl, QIODevice *device);
+    void setStreamOutput(QIODevice *device);
+    void setStreamCallback(std::function<void(const QByteArray &)> callback);
+    void setCacheOptions(quint64 maxBytes, bool useHardLinks);
 
 private:
     quint64 getContentLength(const QUrl &requestedUrl);
     DownloadWorker* pickWorker();
+    void startWorker(DownloadWorker *worker);
+    void assignAddress(REQUEST_PARAM &rqParam);
+    void resolveAddresses(const REQUEST_PARAM &rqParam);
+    QNetworkRequest probeRequest(const QUrl &requestedUrl);
+    bool shouldCompress(const QUrl &requestedUrl, QByteArray *head);
+    void stopWorkers();
+    void setJobPaused(bool paused);
+    void setBatchPaused(bool paused);
+    void updatePauseButton();
+    void startStreamSegments(const REQUEST_PARAM &rqParam, quint64 segmentSize);
+    void scheduleStreamSegments();
+    void startStreamSegment(int index);
+    void writeStreamChunk(const QByteArray &chunk);
+    void finishStream();
+    void releaseStreamWorkers();
+    void clearStreamSegments();
+    ArtifactCache *artifactCache();
+    void failDownload(const QString &message);
+    bool finishFromCache();
+    void storeInCache(const QString &fileName);
+    void discardTempFiles();
+    REQUEST_PARAM requestParam(const QUrl &requestedUrl);
+    void addDownloadRow(const QString &fileName);
+    QByteArray getControlFile(const QUrl &controlUrl);
+    bool startDelta(const QUrl &requestedUrl, const QString &fileName);
+    void scheduleDeltaBatches();
+    void finishDelta();
+    void clearDelta();
 
 signals:
-    void download_progress_signal(qint64 bytesRead, qint64 totalBytes);
     void download_done_signal();
     void cancle_signal();
+    void stop_workers_signal();
+    void pause_signal();
+    void resume_signal();
 
 private slots:
     void downloadFile();
+    void downloadBatch();
+    void batchItemProgress(int index, qint64 bytes, qint64 total);
+    void batchItemFinished(int index, bool ok);
+    void batchFinished(int failed);
+    void downloadDone();
+    void togglePause();
+    void addressStats(const QString &assigned, const QString &used, qint64 bytes, qint64 msecs);
+    void addressFailed(const QString &address);
+    void showDownloadMenu(const QPoint &pos);
     void cancelDownload();
     void httpFinished();
-    void rebuildFile(const QString &fileName);
+    void rebuildFile(const QString &fileName, bool ok);
     void httpReadyRead();
     void enableDownloadButton();
     void slotAuthenticationRequired(QNetworkReply *, QAuthenticator *authenticator);
     void download_progress(qint64 bytesRead);
+    void pumpStream();
+    void streamSegmentDone(const QString &fileName, bool ok);
+    void streamRangeIgnored(const QString &fileName);
+    void deltaBatchHeader(const QString &fileName, const QByteArray &contentType, int status);
+    void deltaBatchDone(const QString &fileName, bool ok);
 #ifndef QT_NO_SSL
     void sslErrors(QNetworkReply *, const QList<QSslError> &errors);
 #endif
@@ -166,7 +284,17 @@ private:
     QLabel *statusLabel;
     QLineEdit *urlLineEdit;
     QPushButton *downloadButton;
+    QPushButton *batchButton;
+    QPushButton *cancelButton;
+    QPushButton *pauseButton;
+    DownloadListModel *downloadModel;
+    DownloadListView *downloadView;
+    int currentRow = -1;
+    int batchFirstRow = 0;
     QCheckBox *launchCheckBox;
+    QCheckBox *streamCheckBox;
+    QCheckBox *cacheCheckBox;
+    QCheckBox *deltaCheckBox;
     QLineEdit *defaultFileLineEdit;
     QLineEdit *downloadDirectoryLineEdit;
     QLineEdit *userNameEdit;
@@ -179,10 +307,51 @@ private:
     QNetworkReply *reply;
     QFile *file;
     QVector<TEMP_FILE> filePools;
-    QVector<DownloadWorker*> downloadWorkerPools;
+    QVector<QPointer<DownloadWorker>> downloadWorkerPools;
     bool httpRequestAborted;
     quint64 totalBytes;
     quint64 currentBytes = 0;
+
+    REQUEST_PARAM streamParam;
+    QVector<STREAM_SEGMENT> streamSegments;
+    QIODevice *streamDevice = nullptr;
+    QFile *standardOutput = nullptr;
+    std::function<void(const QByteArray &)> streamCallback;
+    QString streamTempBase;
+    QScopedPointer<QTemporaryDir> streamTempDir;
+    quint64 streamDelivered = 0;
+    int streamCursor = 0;
+    int streamRunning = 0;
+    quint64 streamWindowBytes;
+
+    ArtifactCache *cache = nullptr;
+    quint64 cacheMaxBytes = 4ULL * 1024 * 1024 * 1024;
+    bool cacheHardLinks = false;
+    CACHE_ENTRY cacheEntry;
+    QByteArray probeETag;
+    QByteArray probeLastModified;
+    QCryptographicHash contentHash;
+    bool cacheHit = false;
+    bool segmentsOk = true;
+    bool lengthKnown = false;
+
+    ZsyncControl deltaControl;
+    QVector<DELTA_BATCH> deltaBatches;
+    REQUEST_PARAM deltaParam;
+    QFile *deltaOut = nullptr;
+    QString deltaTarget;
+    int deltaRunning = 0;
+    int deltaDone = 0;
+    bool deltaPreparing = false;
+
+    BatchDownloader *batch = nullptr;
+    AddressPool addressPool;
+    QByteArray probeContentType;
+    QElapsedTimer downloadClock;
+    bool compressedTransfer = false;
+    QHash<QString, double> hostThroughput;
+    bool jobPaused = false;
+    bool batchPaused = false;
 };
 
 #endif
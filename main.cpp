@@ -49,8 +49,12 @@
 ****************************************************************************/
 
 #include <QApplication>
+#include <QCommandLineParser>
 #include <QDesktopWidget>
 #include <QDir>
+#include <QFile>
+#include <QUrl>
+#include <cstdio>
 
 #include "httpwindow.h"
 
@@ -58,9 +62,37 @@ int main(int argc, char *argv[])
 {
     QApplication app(argc, argv);
 
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption stdoutOption(QStringLiteral("stdout"),
+        QStringLiteral("Stream the download in order to standard output."));
+    parser.addOption(stdoutOption);
+    QCommandLineOption cacheSizeOption(QStringLiteral("cache-size"),
+        QStringLiteral("Size limit of the local cache in MiB (default 4096)."), QStringLiteral("mib"));
+    parser.addOption(cacheSizeOption);
+    QCommandLineOption hardLinkOption(QStringLiteral("cache-hardlinks"),
+        QStringLiteral("Restore cached files as hard links when they cannot be cloned."));
+    parser.addOption(hardLinkOption);
+    parser.addPositionalArgument(QStringLiteral("url"), QStringLiteral("URL to download."));
+    parser.process(app);
+
     HttpWindow httpWin;
+    quint64 cacheMiB = 4096;
+    if (parser.isSet(cacheSizeOption))
+        cacheMiB = parser.value(cacheSizeOption).toULongLong();
+    httpWin.setCacheOptions(cacheMiB * 1024 * 1024, parser.isSet(hardLinkOption));
+    if (parser.isSet(stdoutOption) && !parser.positionalArguments().isEmpty()) {
+        // Pipe mode, e.g. buffalo-downloader --stdout <url> | tar -x
+        QFile out;
+        out.open(stdout, QIODevice::WriteOnly | QIODevice::Unbuffered);
+        QObject::connect(&httpWin, &HttpWindow::download_done_signal, &app, &QCoreApplication::quit, Qt::QueuedConnection);
+        QObject::connect(&httpWin, &HttpWindow::cancle_signal, &app, [&app]() { app.exit(1); }, Qt::QueuedConnection);
+        httpWin.streamRequest(QUrl::fromUserInput(parser.positionalArguments().first()), &out);
+        return app.exec();
+    }
+
     const QRect availableSize = QApplication::desktop()->availableGeometry(&httpWin);
-    httpWin.resize(availableSize.width() / 5, availableSize.height() / 5);
+    httpWin.resize(availableSize.width() / 3, availableSize.height() / 3);
     httpWin.move((availableSize.width() - httpWin.width()) / 2, (availableSize.height() - httpWin.height()) / 2);
 
     httpWin.show();
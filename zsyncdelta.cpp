@@ -0,0 +1,308 @@
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QFile>
+#include <QList>
+
+#include <cstring>
+
+#include "zsyncdelta.h"
+
+const qint64 COPY_CHUNK_SIZE = 1024 * 1024;
+
+bool ZsyncControl::parse(const QByteArray &data)
+{
+    const int headerEnd = data.indexOf("\n\n");
+    if (headerEnd < 0)
+        return false;
+
+    bool compressedOnly = false;
+    const QList<QByteArray> lines = data.left(headerEnd).split('\n');
+    foreach(const QByteArray &line, lines) {
+        const int colon = line.indexOf(':');
+        if (colon < 0)
+            continue;
+        const QByteArray key = line.left(colon).trimmed().toLower();
+        const QByteArray value = line.mid(colon + 1).trimmed();
+        if (key == "blocksize") {
+            blockLength = value.toULongLong();
+        } else if (key == "length") {
+            fileLength = value.toULongLong();
+        } else if (key == "hash-lengths") {
+            const QList<QByteArray> parts = value.split(',');
+            if (parts.size() != 3)
+                return false;
+            seqMatches = parts[0].toInt();
+            rsumBytes = parts[1].toInt();
+            checksumBytes = parts[2].toInt();
+        } else if (key == "url") {
+            targetUrl = QString::fromUtf8(value);
+        } else if (key == "z-url") {
+            compressedOnly = true;
+        } else if (key == "sha-1") {
+            sha1 = QByteArray::fromHex(value);
+        }
+    }
+    // Only plain targets are supported, gzip-recompressed ones need Z-Map2.
+    if (compressedOnly && targetUrl.isEmpty())
+        return false;
+    if (!blockLength || (blockLength & (blockLength - 1)) || !fileLength)
+        return false;
+    if (seqMatches < 1 || seqMatches > 2 || rsumBytes < 1 || rsumBytes > 4
+        || checksumBytes < 3 || checksumBytes > 16)
+        return false;
+    aMask = rsumBytes < 3 ? 0 : rsumBytes == 3 ? 0xff : 0xffff;
+    bMask = rsumBytes < 2 ? 0xff : 0xffff;
+
+    const quint64 count = (fileLength + blockLength - 1) / blockLength;
+    const int record = rsumBytes + checksumBytes;
+    const char *body = data.constData() + headerEnd + 2;
+    if (quint64(data.size() - headerEnd - 2) < count * record)
+        return false;
+
+    blocks.clear();
+    weakIndex.clear();
+    blocks.reserve(int(count));
+    for (quint64 i = 0; i < count; i++) {
+        const char *item = body + i * record;
+        // The weak sum is stored big-endian as a:b with its leading bytes cut.
+        uchar rsum[4] = { 0, 0, 0, 0 };
+        memcpy(rsum + 4 - rsumBytes, item, rsumBytes);
+        ZSYNC_BLOCK block;
+        block.a = quint16((rsum[0] << 8) | rsum[1]);
+        block.b = quint16((rsum[2] << 8) | rsum[3]);
+        block.checksum = QByteArray(item + rsumBytes, checksumBytes);
+        weakIndex.insert(weakKey(block.a, block.b), blocks.size());
+        blocks.push_back(block);
+    }
+    return true;
+}
+
+quint32 ZsyncControl::weakKey(quint16 a, quint16 b) const
+{
+    return (quint32(a & aMask) << 16) | quint32(b & bMask);
+}
+
+bool ZsyncControl::strongMatches(int block, const uchar *data, quint64 available) const
+{
+    QByteArray window;
+    if (available >= blockLength) {
+        window = QByteArray::fromRawData(reinterpret_cast<const char *>(data), int(blockLength));
+    } else {
+        // The last block of the target is hashed zero padded.
+        window = QByteArray(reinterpret_cast<const char *>(data), int(available));
+        window.append(QByteArray(int(blockLength - available), '\0'));
+    }
+    const QByteArray digest = QCryptographicHash::hash(window, QCryptographicHash::Md4);
+    return digest.left(checksumBytes) == blocks[block].checksum;
+}
+
+QVector<qint64> ZsyncControl::matchLocal(const QString &fileName) const
+{
+    QVector<qint64> matches(blocks.size(), -1);
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly) || quint64(file.size()) < blockLength)
+        return matches;
+    const quint64 size = file.size();
+    uchar *data = file.map(0, size);
+    if (!data) {
+        qDebug() << "Zsync: unable to map" << fileName;
+        return matches;
+    }
+
+    // Slide the rolling checksum over every offset, only confirming weak
+    // hits with MD4; a hit jumps a whole block ahead like zsync does.
+    const quint64 last = size - blockLength;
+    quint64 pos = 0;
+    quint16 a = 0;
+    quint16 b = 0;
+    bool fresh = true;
+    while (pos <= last) {
+        if (fresh) {
+            a = 0;
+            b = 0;
+            for (quint64 i = 0; i < blockLength; i++) {
+                a = quint16(a + data[pos + i]);
+                b = quint16(b + (blockLength - i) * data[pos + i]);
+            }
+            fresh = false;
+        }
+
+        bool found = false;
+        const quint32 key = weakKey(a, b);
+        for (auto it = weakIndex.constFind(key); it != weakIndex.constEnd() && it.key() == key; ++it) {
+            const int block = it.value();
+            if (!strongMatches(block, data + pos, size - pos))
+                continue;
+            if (seqMatches > 1 && block + 1 < blocks.size()) {
+                // Short hashes are only unique for a run of two blocks.
+                if (pos + blockLength >= size
+                    || !strongMatches(block + 1, data + pos + blockLength, size - pos - blockLength))
+                    continue;
+            }
+            if (matches[block] < 0)
+                matches[block] = qint64(pos);
+            found = true;
+        }
+        if (found) {
+            pos += blockLength;
+            fresh = true;
+            continue;
+        }
+        if (pos == last)
+            break;
+        const uchar oldc = data[pos];
+        const uchar newc = data[pos + blockLength];
+        a = quint16(a + newc - oldc);
+        b = quint16(b + a - blockLength * oldc);
+        pos++;
+    }
+    file.unmap(data);
+    return matches;
+}
+
+QVector<BYTE_RANGE> ZsyncControl::missingRanges(const QVector<qint64> &matches) const
+{
+    QVector<BYTE_RANGE> ranges;
+    for (int i = 0; i < matches.size(); i++) {
+        if (matches[i] >= 0)
+            continue;
+        const quint64 start = i * blockLength;
+        const quint64 end = qMin(start + blockLength, fileLength) - 1;
+        if (!ranges.isEmpty() && ranges.last().second + 1 == start)
+            ranges.last().second = end;
+        else
+            ranges.push_back(BYTE_RANGE(start, end));
+    }
+    return ranges;
+}
+
+quint64 ZsyncControl::copyMatches(const QString &fileName, const QVector<qint64> &matches, QFile *out) const
+{
+    QFile local(fileName);
+    if (!local.open(QIODevice::ReadOnly))
+        return 0;
+    quint64 reused = 0;
+    for (int i = 0; i < matches.size(); i++) {
+        if (matches[i] < 0)
+            continue;
+        const quint64 start = i * blockLength;
+        const qint64 length = qint64(qMin(start + blockLength, fileLength) - start);
+        local.seek(matches[i]);
+        out->seek(start);
+        out->write(local.read(length));
+        reused += length;
+    }
+    return reused;
+}
+
+bool ZsyncControl::verify(QFile *out) const
+{
+    out->flush();
+    if (quint64(out->size()) != fileLength)
+        return false;
+    out->seek(0);
+    if (!sha1.isEmpty()) {
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        hash.addData(out);
+        return hash.result() == sha1;
+    }
+    // Without a whole-file hash every block has to match its own checksum.
+    for (int i = 0; i < blocks.size(); i++) {
+        const QByteArray block = out->read(qint64(blockLength));
+        if (!strongMatches(i, reinterpret_cast<const uchar *>(block.constData()), quint64(block.size())))
+            return false;
+    }
+    return true;
+}
+
+bool ZsyncControl::writeRangeResponse(const QString &bodyFile, const QByteArray &contentType,
+                                      const QVector<BYTE_RANGE> &ranges, bool wholeBody, QFile *out) const
+{
+    QFile body(bodyFile);
+    if (!body.open(QIODevice::ReadOnly) || ranges.isEmpty())
+        return false;
+
+    const int boundaryAt = contentType.indexOf("boundary=");
+    if (!contentType.toLower().startsWith("multipart/byteranges") || boundaryAt < 0) {
+        // A 200 carries the whole file; a single part may also be the
+        // server merging every requested range into one.
+        const quint64 start = wholeBody ? 0 : ranges.first().first;
+        const quint64 length = wholeBody ? fileLength : ranges.last().second - start + 1;
+        if (quint64(body.size()) != length)
+            return false;
+        out->seek(start);
+        while (!body.atEnd())
+            out->write(body.read(COPY_CHUNK_SIZE));
+        return true;
+    }
+
+    QByteArray boundary = contentType.mid(boundaryAt + 9);
+    const int semicolon = boundary.indexOf(';');
+    if (semicolon >= 0)
+        boundary.truncate(semicolon);
+    boundary = boundary.trimmed();
+    if (boundary.startsWith('"') && boundary.endsWith('"'))
+        boundary = boundary.mid(1, boundary.size() - 2);
+    const QByteArray delimiter = "--" + boundary;
+
+    const qint64 size = body.size();
+    uchar *mapped = body.map(0, size);
+    if (!mapped)
+        return false;
+    const QByteArray data = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), int(size));
+    QVector<BYTE_RANGE> parts;
+    bool ok = true;
+    int pos = data.indexOf(delimiter);
+    while (pos >= 0) {
+        pos += delimiter.size();
+        if (data.mid(pos, 2) == "--")
+            break;
+        const int headerEnd = data.indexOf("\r\n\r\n", pos);
+        if (headerEnd < 0) {
+            ok = false;
+            break;
+        }
+        const QByteArray headers = data.mid(pos, headerEnd - pos).toLower();
+        const int rangeAt = headers.indexOf("content-range:");
+        const int bytesAt = headers.indexOf("bytes", rangeAt);
+        if (rangeAt < 0 || bytesAt < 0) {
+            ok = false;
+            break;
+        }
+        const int dash = headers.indexOf('-', bytesAt);
+        const int slash = headers.indexOf('/', dash);
+        const quint64 start = headers.mid(bytesAt + 5, dash - bytesAt - 5).trimmed().toULongLong();
+        const quint64 end = headers.mid(dash + 1, slash - dash - 1).trimmed().toULongLong();
+        const int dataStart = headerEnd + 4;
+        const qint64 length = qint64(end - start + 1);
+        if (end < start || dataStart + length > size) {
+            ok = false;
+            break;
+        }
+        out->seek(start);
+        out->write(data.constData() + dataStart, length);
+        parts.push_back(BYTE_RANGE(start, end));
+        pos = data.indexOf(delimiter, int(dataStart + length));
+    }
+    body.unmap(mapped);
+
+    // A short body just ends early; every requested byte must have come
+    // back in some part, the server may have merged neighbouring ranges.
+    for (const BYTE_RANGE &range : ranges) {
+        quint64 next = range.first;
+        bool progressed = true;
+        while (ok && next <= range.second && progressed) {
+            progressed = false;
+            for (const BYTE_RANGE &part : parts) {
+                if (part.first <= next && next <= part.second) {
+                    next = part.second + 1;
+                    progressed = true;
+                    break;
+                }
+            }
+        }
+        if (next <= range.second)
+            ok = false;
+    }
+    return ok;
+}
@@ -0,0 +1,58 @@
+#ifndef ZSYNCDELTA_H
+#define ZSYNCDELTA_H
+
+#include <QByteArray>
+#include <QMultiHash>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+class QFile;
+QT_END_NAMESPACE
+
+struct ZSYNC_BLOCK {
+    quint16 a = 0;
+    quint16 b = 0;
+    QByteArray checksum;
+};
+
+typedef QPair<quint64, quint64> BYTE_RANGE;
+
+// Block checksum list from a zsync control file, used to find which blocks
+// of an old local copy can be reused so only the rest is fetched by Range.
+class ZsyncControl
+{
+public:
+    bool parse(const QByteArray &data);
+
+    QVector<qint64> matchLocal(const QString &fileName) const;
+    QVector<BYTE_RANGE> missingRanges(const QVector<qint64> &matches) const;
+    quint64 copyMatches(const QString &fileName, const QVector<qint64> &matches, QFile *out) const;
+    bool verify(QFile *out) const;
+
+    bool writeRangeResponse(const QString &bodyFile, const QByteArray &contentType,
+                            const QVector<BYTE_RANGE> &ranges, bool wholeBody, QFile *out) const;
+
+    quint64 length() const { return fileLength; }
+    quint64 blockSize() const { return blockLength; }
+    QString url() const { return targetUrl; }
+
+private:
+    bool strongMatches(int block, const uchar *data, quint64 available) const;
+    quint32 weakKey(quint16 a, quint16 b) const;
+
+    quint64 blockLength = 0;
+    quint64 fileLength = 0;
+    int seqMatches = 1;
+    int rsumBytes = 4;
+    int checksumBytes = 16;
+    quint16 aMask = 0xffff;
+    quint16 bMask = 0xffff;
+    QString targetUrl;
+    QByteArray sha1;
+    QVector<ZSYNC_BLOCK> blocks;
+    QMultiHash<quint32, int> weakIndex;
+};
+
+#endif // ZSYNCDELTA_H